@@ -3,6 +3,8 @@
 #include "routing.hpp"
 #include "helpers.hpp"
 #include "dispatcher.hpp"
+#include "instance.hpp"
+#include "metrics.hpp"
 #include <iostream>
 #include "units.h"
 #include "range/v3/view/filter.hpp"
@@ -45,27 +47,10 @@ std::ostream& operator<<(std::ostream &os, const Ambulance::Type& t) {
 }
 
 
-std::istream &operator>>(std::istream &is, Ambulance &a)
-{
-  unsigned long hours, minutes;
-  std::string tmp;
-  is >> a.id >> a.description >> a.type >> a.base;
-  std::getline(is, tmp, ':');
-  hours = std::stoul(tmp);
-  std::getline(is, tmp, ' ');
-  minutes = std::stoul(tmp);
-  a.shift_start = (hours * 60 + minutes) * 60; // TODO: time granularity is fixed to second
-  std::getline(is, tmp, ':');
-  hours = std::stoul(tmp);
-  std::getline(is, tmp);
-  minutes = std::stoul(tmp);
-  a.shift_end = (hours * 60 + minutes) * 60; // TODO: time granularity is fixed to second
-  return is;
-}
 
 simcpp20::event<Time> Ambulance::shift()
 {
-  std::shared_ptr<Ambulance> a = ambulances[index];
+  std::shared_ptr<Ambulance> a = context.ambulances[index];
   Time offset = (conf.start_time - pt::ptime(conf.start_time.date())).total_seconds();
   // it assumes that sim.now() is 0 and synchronous with midnight
   assert(sim.now() == 0);
@@ -88,9 +73,9 @@ simcpp20::event<Time> Ambulance::shift()
     start_duty = current_daystart - current_daytime;
     end_duty = limit;
     current_state = WAITING_AT_BASE;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
     current_position_ = base;
-    dispatcher.ambulance_available(ambulances[index]);
+    dispatcher.ambulance_available(context.ambulances[index]);
     co_return;
   }
   while (start_duty <= limit) {
@@ -106,13 +91,13 @@ simcpp20::event<Time> Ambulance::shift()
     spdlog::info("[{}] Ambulance {} starts service up to {}", std::to_string(conf.start_time, sim.now()), *this, std::to_string(conf.start_time, end_duty));
 #endif
     current_state = WAITING_AT_BASE;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
     current_position_ = base;
-    dispatcher.ambulance_available(ambulances[index]);
+    dispatcher.ambulance_available(context.ambulances[index]);
     co_await sim.timeout(end_duty - sim.now());
-    co_await dispatcher.ambulance_unavailable(ambulances[index]);
+    co_await dispatcher.ambulance_unavailable(context.ambulances[index]);
     current_state = UNAVAILABLE;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
 #ifdef LOGGING
     spdlog::info("[{}] Ambulance {} ends service", std::to_string(conf.start_time, sim.now()), *this);
 #endif
@@ -145,7 +130,7 @@ void Ambulance::assign(std::shared_ptr<Emergency> e, Routing::Segment initial_se
 }
 
 simcpp20::event<Time> Ambulance::rescue_started(std::shared_ptr<Emergency> e, Routing::Segment initial_segment) {
-  auto a = ambulances[index];
+  auto a = context.ambulances[index];
   co_await sim.timeout(0); // in order to maintain order of events (i.e., pre-empt first, then proceed with the new assignment)
   assert(current_emergency == nullptr);
   current_segment = initial_segment;
@@ -182,7 +167,7 @@ simcpp20::event<Time> Ambulance::to_emergency(bool pair) {
   current_state = TO_EMERGENCY;
   auto e = current_emergency;
   auto s = current_segment;
-  SimulationData::log_ambulance(*this, *e, sim.now(), conf.start_time);
+  context.data->log_ambulance(*this, *e, sim.now());
 #ifdef LOGGING
   if (current_state == WAITING_AT_BASE) {
     spdlog::info("[{}] Ambulance {} going to emergency {} from base {} ({}, {})", std::to_string(conf.start_time, sim.now()), *this, *e, std::to_string(current_position_), units::time::to_string(s.duration), units::length::to_string(s.distance));
@@ -203,7 +188,7 @@ simcpp20::event<Time> Ambulance::to_emergency(bool pair) {
       rescue_finished_.trigger();
       rescue_finished_ = sim.event<Time>();
       current_state = PREEMPTED;
-      SimulationData::log_ambulance(*this, *e, sim.now(), conf.start_time);
+      context.data->log_ambulance(*this, *e, sim.now());
       e->current_state = Emergency::WAITING_AMBULANCE;
       current_emergency = nullptr;
       dispatcher.preempted_emergency(e);
@@ -212,6 +197,9 @@ simcpp20::event<Time> Ambulance::to_emergency(bool pair) {
   } else {
     co_await travel_to(s);
   }
+  // only the first ambulance reaching the emergency counts for the response time
+  if (e->reaching_time == std::numeric_limits<Time>::max())
+    context.metrics->emergency_reached(*e, sim.now());
   e->reaching_time = std::min(e->reaching_time, sim.now());
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} reached emergency {} after {}", std::to_string(conf.start_time, sim.now()), *this, *e, units::time::to_string(units::time::minute_t(units::time::second_t(sim.now() - e->occurring_time))));
@@ -229,8 +217,8 @@ simcpp20::event<Time> Ambulance::to_emergency(bool pair) {
 simcpp20::event<Time> Ambulance::treatment() {
   current_state = ON_TREATMENT;
   auto e = current_emergency;
-  auto a = ambulances[index];
-  SimulationData::log_ambulance(*this, *e, sim.now(), conf.start_time);
+  auto a = context.ambulances[index];
+  context.data->log_ambulance(*this, *e, sim.now());
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} treating emergency {} for {}", std::to_string(conf.start_time, sim.now()), *this, *e, units::time::to_string(units::time::second_t(e->treatment_duration)));
 #endif
@@ -239,7 +227,8 @@ simcpp20::event<Time> Ambulance::treatment() {
   if (e->needs_hospital)
     co_await to_hospital();
   else {
-    SimulationData::log_rescue(*e, *this, conf.start_time);
+    context.data->log_rescue(*e, *this);
+    dispatcher.emergency_served(e);
     current_emergency = nullptr;
     co_await to_base();
   }
@@ -248,13 +237,13 @@ simcpp20::event<Time> Ambulance::treatment() {
 simcpp20::event<Time> Ambulance::to_hospital() {
   current_state = TO_HOSPITAL;
   auto e = current_emergency;
-  SimulationData::log_ambulance(*this, *e, sim.now(), conf.start_time);
+  context.data->log_ambulance(*this, *e, sim.now());
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} finished treating emergency {}", std::to_string(conf.start_time, sim.now()), *this, *e);
 #endif
 
   // searching hospital
-  auto compatible_hospitals = Hospital::hospitals | views::filter([e](auto h) { return (e->needed_hospital == Hospital::SPOKE && h->type != Hospital::PEDIATRIC) || h->type == e->needed_hospital; });
+  auto compatible_hospitals = context.hospitals | views::filter([e](auto h) { return (e->needed_hospital == Hospital::SPOKE && h->type != Hospital::PEDIATRIC) || h->type == e->needed_hospital; });
   std::vector<Routing::Segment> result = routing.compute_distances(e->place, compatible_hospitals | views::transform([](auto h) { return h->place; }) | to<std::list>());
   auto distances = views::zip(compatible_hospitals, result) | to<std::vector> | actions::sort([](auto p1, auto p2) { return p1.second.duration < p2.second.duration; });
   auto h = distances.front().first;
@@ -267,10 +256,12 @@ simcpp20::event<Time> Ambulance::to_hospital() {
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} reached hospital {} for emergency {}", std::to_string(conf.start_time, sim.now()), *this, *h, *e);
 #endif
+  if (e->at_hospital_time == std::numeric_limits<Time>::max())
+    context.metrics->emergency_at_hospital(*e, *h, sim.now());
   e->at_hospital_time = sim.now();
   if (type != MV) {
-    const std::shared_ptr<Ambulance> a = ambulances[index];
-    SimulationData::log_rescue(*e, *this, conf.start_time);
+    const std::shared_ptr<Ambulance> a = context.ambulances[index];
+    context.data->log_rescue(*e, *this);
 #ifdef LOGGING
     spdlog::info("[{}] Ambulance {} discharging emergency {} at hospital {}", std::to_string(conf.start_time, sim.now()), *this, *e, *h);
 #endif
@@ -287,7 +278,7 @@ simcpp20::event<Time> Ambulance::to_hospital() {
   
 simcpp20::event<Time> Ambulance::cleaning() {
   current_state = CLEANING;
-  SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+  context.data->log_ambulance(*this, sim.now());
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} cleaning", std::to_string(conf.start_time, sim.now()), *this);
 #endif
@@ -299,13 +290,13 @@ simcpp20::event<Time> Ambulance::to_base() {
   // going to base
   auto s = routing.compute_distances(current_position(), base);
   Time end_travel = sim.now() + Time(s.duration / units::time::second_t(1.0));
-  if (end_travel < end_duty && s.distance < DISTANCE_THRESHOLD) {
+  if (end_travel < end_duty && s.distance < context.distance_threshold) {
     current_state = TO_BASE;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
 #ifdef LOGGING
   spdlog::info("[{}] Ambulance {} going to base ({}, {})", std::to_string(conf.start_time, sim.now()), *this, units::time::to_string(s.duration), units::length::to_string(s.distance));
 #endif
-    dispatcher.assignable_ambulance(ambulances[index]);
+    dispatcher.assignable_ambulance(context.ambulances[index]);
   } else {
 #ifdef LOGGING
     if (end_travel > end_duty)
@@ -314,7 +305,7 @@ simcpp20::event<Time> Ambulance::to_base() {
       spdlog::info("[{}] Ambulance {} going to base (not preemtable {}, {})", std::to_string(conf.start_time, sim.now()), *this, units::time::to_string(s.duration), units::length::to_string(s.distance));
 #endif
     current_state = UNAVAILABLE;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
   }
   auto ev = travel_to(s);
   co_await sim.any_of(ev, preempt_);
@@ -324,18 +315,18 @@ simcpp20::event<Time> Ambulance::to_base() {
       spdlog::info("[{}] Ambulance {} back to base and waiting", std::to_string(conf.start_time, sim.now()), *this);
 #endif
       current_state = WAITING_AT_BASE;
-      dispatcher.assignable_ambulance(ambulances[index]);
-      SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+      dispatcher.assignable_ambulance(context.ambulances[index]);
+      context.data->log_ambulance(*this, sim.now());
     } else {
 #ifdef LOGGING
     spdlog::info("[{}] Ambulance {} back to base, finished shift at {}", std::to_string(conf.start_time, sim.now()), *this, std::to_string(conf.start_time, end_duty));
 #endif
       current_state = UNAVAILABLE;
-      SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+      context.data->log_ambulance(*this, sim.now());
     }
   } else {
     current_state = PREEMPTED;
-    SimulationData::log_ambulance(*this, sim.now(), conf.start_time);
+    context.data->log_ambulance(*this, sim.now());
 #ifdef LOGGING
     spdlog::info("[{}] Ambulance {} pre-empted while going back to base", std::to_string(conf.start_time, sim.now()), *this);
 #endif
@@ -347,10 +338,12 @@ simcpp20::event<Time> Ambulance::to_base() {
 
 simcpp20::event<Time> Ambulance::travel_to(const Routing::Segment& s) {
   current_segment = s;
-  current_route.clear();
+  current_route.reset();
+  reference_route.reset();
   moving = true;
   travel_start = sim.now();
   travel_time = s.duration / units::time::second_t(1.0);
+  dispatcher.ambulance_moved(context.ambulances[index]);
   auto ev = sim.timeout(travel_time);
   co_await sim.any_of(ev, preempt_);
   if (!ev.processed()) {
@@ -359,51 +352,64 @@ simcpp20::event<Time> Ambulance::travel_to(const Routing::Segment& s) {
   else {
     current_position_ = s.end_point;
     moving = false;
+    dispatcher.ambulance_moved(context.ambulances[index]);
   }
 }
 
-Coordinate Ambulance::current_position() {
+Coordinate Ambulance::position(PositionModel model, std::shared_ptr<const Route>& route) {
   // FIXME: if currently on the highway it should wait to 
   if (!moving)
     return current_position_;
-  if (current_route.size() == 0) {
-    current_route = routing.compute_route(current_segment.start_point, current_segment.end_point);
-  }
-  auto accumulated_time = units::time::second_t(travel_start), now = units::time::second_t(sim.now()), finish_time = units::time::second_t(travel_start + travel_time);
-  if (finish_time > now) {
-    Coordinate position = current_segment.start_point;
-    for (auto leg : current_route) {
-      position = leg.start_point;
-      if (accumulated_time > now) {
-        return position;
-      }
-      accumulated_time += leg.duration;
+  if (travel_start + travel_time > sim.now()) {
+    double fraction = double(sim.now() - travel_start) / travel_time;
+    switch (model) {
+      case PositionModel::LINEAR:
+        return Route::interpolate(current_segment.start_point, current_segment.end_point, fraction);
+      case PositionModel::EXACT:
+        // the steps of the route are walked with their own durations, the position is the start of the next step
+        if (travel_route(model, route)->steps() > 0)
+          return route->next_step(double(sim.now() - travel_start));
+        break;
+      case PositionModel::ROUTE_CACHED:
+        // the travel time comes from the table, the route durations are rescaled to it
+        if (travel_route(model, route)->steps() > 0)
+          return route->position(fraction * route->duration());
+        break;
     }
   }
   current_position_ = current_segment.end_point;
   return current_position_;
 }
 
-void Ambulance::source(std::istream &is, simcpp20::simulation<Time> &sim, config &conf, Dispatcher& dispatcher, Routing& routing)
+std::shared_ptr<const Route> Ambulance::travel_route(PositionModel model, std::shared_ptr<const Route>& route) {
+  if (!route && model != PositionModel::LINEAR)
+    route = routing.route(current_segment.start_point, current_segment.end_point, model == PositionModel::ROUTE_CACHED);
+  return route;
+}
+
+void Ambulance::source(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher, Routing& routing)
 {
-  while (!is.eof())
+  auto& ambulances = context.ambulances;
+  for (const auto& r : instance.ambulances)
   {
-    auto a = std::make_shared<Ambulance>(sim, conf, dispatcher, routing);
-    is >> *a;
+    auto a = std::make_shared<Ambulance>(sim, context, dispatcher, routing);
+    a->id = r.id;
+    a->description = r.description;
+    a->type = r.type;
+    a->base = r.base;
+    a->shift_start = r.shift_start;
+    a->shift_end = r.shift_end;
     ambulances.push_back(a);
     a->index = ambulances.size() - 1;
     a->shift();
   }
-#ifdef LOGGING
-  spdlog::debug("Read {} ambulances", ambulances.size());
-#endif
 }
 
+
 simcpp20::event<Time> Ambulance::rescue_finished() {
   return rescue_finished_;
 }
 
-std::vector<std::shared_ptr<Ambulance>> Ambulance::ambulances;
 
 std::string std::to_string(Ambulance::State s) {
   switch (s) {
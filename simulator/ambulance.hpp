@@ -5,11 +5,12 @@
 
 class Emergency;
 class Dispatcher;
+class Instance;
 
 class Ambulance : public SimulationEntity {
   friend class Dispatcher;
 public:
-  Ambulance(simcpp20::simulation<Time>& sim, config& conf, Dispatcher& dispatcher, Routing& routing) : SimulationEntity(sim, conf), current_emergency(nullptr), moving(false), current_state(UNAVAILABLE), dispatcher(dispatcher), rescue_finished_(sim.event<Time>()), routing(routing) {}
+  Ambulance(simcpp20::simulation<Time>& sim, SimulationContext& context, Dispatcher& dispatcher, Routing& routing) : SimulationEntity(sim, context), current_emergency(nullptr), moving(false), current_state(UNAVAILABLE), dispatcher(dispatcher), rescue_finished_(sim.event<Time>()), routing(routing) {}
   enum Type
   {
     ALS,
@@ -47,7 +48,8 @@ protected:
   Time travel_start, travel_time;
   Routing::Segment current_segment;
   Coordinate current_position_;
-  std::list<Routing::Segment> current_route;
+  // routes of the current travel, for the position model and for the reference one
+  std::shared_ptr<const Route> current_route, reference_route;
   bool preemptable(std::shared_ptr<Emergency> e) const;
   inline bool waiting() const {
     return current_state == WAITING_AT_BASE;
@@ -64,16 +66,22 @@ protected:
   simcpp20::event<Time> cleaning();
   simcpp20::event<Time> to_base();
   simcpp20::event<Time> travel_to(const Routing::Segment& s);
-  Coordinate current_position();
+  inline Coordinate current_position() { return position(conf.position_model, current_route); }
+  // position according to the reference model, only used to compare the models
+  inline Coordinate reference_position() { return position(*conf.position_reference, reference_route); }
+  Coordinate position(PositionModel model, std::shared_ptr<const Route>& route);
+  // route of the current travel for the model (none for the linear one), computed once per travel
+  std::shared_ptr<const Route> travel_route(PositionModel model, std::shared_ptr<const Route>& route);
   simcpp20::event<Time> rescue_finished_;
 public:
-  static void source(std::istream &is, simcpp20::simulation<Time> &sim, config &conf, Dispatcher& dispatcher, Routing& routing);
+  static void source(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher, Routing& routing);
 protected:
-  static std::vector<std::shared_ptr<Ambulance>> ambulances;
   Dispatcher& dispatcher;
   Routing& routing;
 };
 
+std::istream& operator>>(std::istream &is, Ambulance::Type& t);
+
 namespace std {
 string to_string(Ambulance::State s);
 }
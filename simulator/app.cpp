@@ -9,6 +9,8 @@
 #include <iomanip>
 #include <chrono>
 #include <vector>
+#include <thread>
+#include <atomic>
 
 #include "simcpp20/simcpp20.hpp"
 #include "simcpp20/resource.hpp"
@@ -18,6 +20,14 @@
 #include "hospital.hpp"
 #include "dispatcher.hpp"
 #include "helpers.hpp"
+#include "osrm_routing.hpp"
+#include "haversine_routing.hpp"
+#include "travel_matrix.hpp"
+#include "instance.hpp"
+#include "sqlite_sink.hpp"
+#include "csv_sink.hpp"
+#include "columnar_sink.hpp"
+#include "metrics.hpp"
 
 #include <boost/program_options.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -61,10 +71,18 @@ simcpp20::event<Time> manage_progress_bar(simcpp20::simulation<Time> &sim, confi
   bar.set_progress(amount);
 }
 
+// the replication number is added before the extension of the file name
+std::string replication_filename(const std::string& filename, unsigned int replication)
+{
+  auto dot = filename.find_last_of('.');
+  auto slash = filename.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = filename.size();
+  return filename.substr(0, dot) + "-" + std::to_string(replication) + filename.substr(dot);
+}
+
 int main(int argc, const char *argv[])
 {
-  simcpp20::simulation<Time> sim;
-  
   // default values
   config conf{
     .dispatcher_call_dist_red = std::exponential_distribution<>{1. / 253},
@@ -76,43 +94,72 @@ int main(int argc, const char *argv[])
   };
   
   unsigned long seed = 42;
+  unsigned int replications = 1, threads = std::max(1u, std::thread::hardware_concurrency());
   std::string start_time, end_time;
-  std::string log_filename, data_filename;
-  bool progress = false, no_log = false, not_preemptable = false;
-  double dt, tt;
+  std::string instance_filename, log_filename, data_filename, metrics_filename, routing_backend, routing_cache_filename, travel_matrix_filename;
+  HaversineRouting::SpeedModel speed_model;
+  SimulationData::Options data_options;
+  SQLiteSink::Options sqlite_options;
+  std::string data_sink = "sqlite";
+  std::string position_model = "route-cached", position_reference;
+  size_t routing_cache_size = RoutingCache::DEFAULT_SIZE, route_cache_size = RouteCache::DEFAULT_SIZE;
+  double travel_matrix_cell_size = 0.0;
+  bool progress = false, no_log = false, not_preemptable = false, colored = false, data_no_sync = false, data_compact = false;
+  double dt = 0.0, tt = 0.0, max_speed = 0.0;
+  size_t routing_candidates = 0;
   double red_call_lambda, yellow_call_lambda, green_call_lambda, white_call_lambda;
   po::options_description desc("Command line options");
   desc.add_options()("help,?", "print usage message")
+  ("instance,i", po::value(&instance_filename), "Binary instance file (built by convert), in place of the emergencies, ambulances and hospitals files")
   ("emergencies,e", po::value(&conf.emergencies_filename), "Emergencies file")
   ("ambulances,a", po::value(&conf.ambulances_filename), "Ambulances file")
   ("hospitals,h", po::value(&conf.hospitals_filename), "Hospital file")
   ("routing,r", po::value(&conf.osrm_filename), "Routing data file(s)")
+  ("routing-backend", po::value(&routing_backend), "Routing backend (osrm, matrix or haversine), osrm by default when routing data is provided")
+  ("routing-cache", po::value(&routing_cache_filename), "Routing cache file (loaded at start if it exists, saved at the end)")
+  ("routing-cache-size", po::value(&routing_cache_size), "Maximum number of routing cache entries")
+  ("route-cache-size", po::value(&route_cache_size), "Maximum number of cached route geometries (0 disables the cache)")
+  ("travel-matrix-cell-size", po::value(&travel_matrix_cell_size), "Precompute a travel matrix among bases, hospitals and emergency cells of the given size (in km)")
+  ("travel-matrix", po::value(&travel_matrix_filename), "Travel matrix file (loaded if it exists, otherwise computed and saved)")
+  ("detour-factor", po::value(&speed_model.detour_factor), "Ratio between road and haversine distance (haversine backend)")
+  ("urban-speed", po::value(&speed_model.urban_speed), "Speed on urban roads in km/h (haversine backend)")
+  ("rural-speed", po::value(&speed_model.rural_speed), "Speed on extra-urban roads in km/h (haversine backend)")
+  ("highway-speed", po::value(&speed_model.highway_speed), "Speed on highways in km/h (haversine backend)")
+  ("position-model", po::value(&position_model), "Position of the travelling ambulances (exact: start of the next step of the uncached route, linear: straight line, route-cached: interpolated along the cached route), route-cached by default")
+  ("position-reference", po::value(&position_reference), "Also evaluate the dispatch decisions with this position model and count the differences (disables the pruning of the candidates, so their counts are not comparable with a run without it)")
   ("seed,s", po::value(&seed), "Random seed")
+  ("replications", po::value(&replications), "Number of independent replications (the k-th one uses seed + k)")
+  ("threads,j", po::value(&threads), "Number of threads running the replications")
   ("start-time", po::value(&start_time), "Simulation start time")
   ("end-time", po::value(&end_time), "Simulation end time")
   ("progress-bar,p", po::bool_switch(&progress), "Show progress bar")
   ("no-log,n", po::bool_switch(&no_log), "Disable log")
   ("colored-log,c", po::bool_switch(&colored), "Show colored log")
   ("log-file,l", po::value(&log_filename), "Log file")
-  ("data-file,d", po::value(&data_filename), "Simulation SQLite filename")
+  ("data-file,d", po::value(&data_filename), "Simulation SQLite filename (directory for the csv and columnar data sinks)")
+  ("data-sink", po::value(&data_sink), "Simulation data format (sqlite, csv, columnar or none), sqlite by default")
+  ("metrics-file", po::value(&metrics_filename), "JSON file for the summary of the performance indicators")
+  ("data-batch-size", po::value(&data_options.batch_size), "Number of rows committed at once to the simulation database")
+  ("data-batch-interval", po::value(&data_options.batch_interval), "Maximum time (in seconds) a batch of rows is kept uncommitted")
+  ("data-wal", po::bool_switch(&sqlite_options.wal), "Use write-ahead logging for the simulation database")
+  ("data-no-sync", po::bool_switch(&data_no_sync), "Do not wait for the simulation database writes to reach the disk")
+  ("data-compact", po::bool_switch(&data_compact), "Store times, identifiers and codes as integers (with lookup tables) in the simulation data")
+  ("data-queue-size", po::value(&data_options.queue_size), "Number of records the simulation can queue before waiting for the database writer")
   ("rescue-distance-threshold,dt", po::value(&dt), "Rescue distance threshold (in km)")
   ("rescue-time-threshold,tt", po::value(&tt), "Rescue time threshold (in minutes)")
+  ("max-speed", po::value(&max_speed), "Maximum speed on the road network (in km/h), for the lower bound of the travel times of the candidate ambulances; it must be at least the fastest speed of the routing profile, or better ambulances may be pruned (0 disables the pruning)")
+  ("routing-candidates", po::value(&routing_candidates), "Number of candidate ambulances routed at once, best first (0 routes all of them, as with --position-reference)")
   ("red-call-lambda,rcl", po::value(&red_call_lambda), "Lambda value for dispatching red calls")
   ("yellow-call-lambda,ycl", po::value(&yellow_call_lambda), "Lambda value for dispatching yellow calls")
   ("green-call-lambda,gcl", po::value(&green_call_lambda), "Lambda value for dispatching green calls")
   ("white-call-lambda,wcl", po::value(&white_call_lambda), "Lambda value for dispatching white calls")
   ("not-preemptable", po::bool_switch(&not_preemptable), "Non preemtable events");
   
-  std::mt19937 rd(seed);
-  // this will use hardware entropy
-  //std::random_device rd;
-  conf.gen = std::default_random_engine{rd()};
-  
   // Parse command line arguments
   po::variables_map vm;
   po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
   po::notify(vm);
-  if (vm.count("help") || !vm.count("emergencies") || !vm.count("ambulances") || !vm.count("routing") || !vm.count("hospitals")) {
+  if (vm.count("help") || (!vm.count("instance") && (!vm.count("emergencies") || !vm.count("ambulances") || !vm.count("hospitals"))) || (!vm.count("routing") && !vm.count("travel-matrix") && !vm.count("routing-backend"))) {
     std::cerr << desc << "\n";
     return 1;
   }
@@ -122,13 +169,33 @@ int main(int argc, const char *argv[])
   if (vm.count("end-time")) {
     conf.end_time = pt::time_from_string(end_time);
   }
-  if (vm.count("rescue-distance-threshold")) {
-    DISTANCE_THRESHOLD = units::length::kilometer_t(dt);
+  if (replications == 0) {
+    throw std::logic_error("At least one replication is needed");
+    return -1;
   }
-  if (vm.count("rescue-time-threshold")) {
-    TIME_THRESHOLD = units::time::minute_t(tt);
+  // an empty queue would be always full, and the simulation would wait for the writer forever
+  if (data_options.queue_size == 0 || data_options.batch_size == 0) {
+    throw std::logic_error("The data queue and batch sizes must be positive");
+    return -1;
   }
   conf.preemptable = !not_preemptable;
+  auto parse_position_model = [](const std::string& name) {
+    if (name == "exact")
+      return PositionModel::EXACT;
+    else if (name == "linear")
+      return PositionModel::LINEAR;
+    else if (name == "route-cached")
+      return PositionModel::ROUTE_CACHED;
+    throw std::logic_error("Position model (" + name + ") not recognized");
+  };
+  conf.position_model = parse_position_model(position_model);
+  if (vm.count("position-reference"))
+    conf.position_reference = parse_position_model(position_reference);
+  sqlite_options.synchronous = !data_no_sync;
+  if (data_sink != "sqlite" && data_sink != "csv" && data_sink != "columnar" && data_sink != "none") {
+    throw std::logic_error("Data sink (" + data_sink + ") not recognized");
+    return -1;
+  }
   
   if (no_log) {
     spdlog::set_level(spdlog::level::off);
@@ -156,60 +223,201 @@ int main(int argc, const char *argv[])
     conf.dispatcher_call_dist_white = std::exponential_distribution<>(1.0 / white_call_lambda);
   }
   
+  // the instance is read once and shared by all the replications
+  Instance instance;
   std::ifstream is;
   
-  osrm::EngineConfig config;
-  config.storage_config = {conf.osrm_filename};
-  config.use_shared_memory = false;
-  config.algorithm = osrm::EngineConfig::Algorithm::CH;
-  Routing routing(config);
-  SimulationData::set_database(!data_filename.empty() ? data_filename : "default.sqlite3.db");
+  if (vm.count("instance")) {
+    if (!instance.open(instance_filename))
+    {
+      throw std::logic_error("Could not open instance file " + instance_filename);
+      return -1;
+    }
+  } else {
+    if (!instance.load_emergencies(conf.emergencies_filename))
+    {
+      throw std::logic_error("Could not open emergencies file " + conf.emergencies_filename);
+      return -1;
+    }
+    
+    is.open(conf.ambulances_filename);
+    if (!is)
+    {
+      throw std::logic_error("Could not open ambulances file " + conf.ambulances_filename);
+      return -1;
+    }
+    instance.read_ambulances(is);
+    is.close();
+    
+    is.open(conf.hospitals_filename);
+    if (!is)
+    {
+      throw std::logic_error("Could not open hospitals file " + conf.hospitals_filename);
+      return -1;
+    }
+    instance.read_hospitals(is);
+    is.close();
+  }
   
-  Dispatcher dispatcher(sim, conf, routing);
+  // the horizon is shared by the replications, and is needed by the data sinks (for their epoch) as soon as they are built
+  Emergency::resolve_horizon(instance, conf);
   
-  is.open(conf.emergencies_filename);
-  if (!is)
-  {
-    throw std::logic_error("Could not open emergencies file " + conf.emergencies_filename);
+  if (routing_backend.empty())
+    routing_backend = vm.count("routing") ? "osrm" : "matrix";
+  std::unique_ptr<Routing> backend;
+  if (routing_backend == "osrm") {
+    if (!vm.count("routing"))
+    {
+      throw std::logic_error("The osrm routing backend requires routing data");
+      return -1;
+    }
+    osrm::EngineConfig config;
+    config.storage_config = {conf.osrm_filename};
+    config.use_shared_memory = false;
+    config.algorithm = osrm::EngineConfig::Algorithm::CH;
+    backend = std::make_unique<OSRMRouting>(config, routing_cache_size);
+  } else if (routing_backend == "haversine") {
+    backend = std::make_unique<HaversineRouting>(speed_model);
+  } else if (routing_backend != "matrix") {
+    throw std::logic_error("Routing backend (" + routing_backend + ") not recognized");
     return -1;
   }
-  Emergency::source(is, sim, conf, dispatcher);
-  is.close();
-  
-  is.open(conf.ambulances_filename);
-  if (!is)
-  {
-    throw std::logic_error("Could not open ambulances file " + conf.ambulances_filename);
-    return -1;
+  // the backend used to compute the travel matrix, if needed
+  Routing* engine = backend.get();
+  std::unique_ptr<Routing> routing;
+  std::shared_ptr<TravelMatrix> matrix;
+  MatrixRouting* matrix_routing = nullptr;
+  if (routing_backend == "matrix" || !travel_matrix_filename.empty() || travel_matrix_cell_size > 0.0) {
+    if (!travel_matrix_filename.empty() && std::ifstream(travel_matrix_filename)) {
+      matrix = std::make_shared<TravelMatrix>();
+      if (!matrix->open(travel_matrix_filename))
+      {
+        throw std::logic_error("Could not open travel matrix file " + travel_matrix_filename);
+        return -1;
+      }
+    } else if (!engine) {
+      if (travel_matrix_filename.empty())
+        throw std::logic_error("The matrix routing backend requires either a travel matrix file or a routing backend to compute it");
+      throw std::logic_error("Could not open travel matrix file " + travel_matrix_filename);
+      return -1;
+    }
+    auto r = std::make_unique<MatrixRouting>(matrix, std::move(backend));
+    matrix_routing = r.get();
+    routing = std::move(r);
+  } else {
+    routing = std::move(backend);
   }
-  Ambulance::source(is, sim, conf, dispatcher, routing);
-  is.close();
-  
-  is.open(conf.hospitals_filename);
-  if (!is)
-  {
-    throw std::logic_error("Could not open hospitals file " + conf.hospitals_filename);
-    return -1;
+  routing->route_cache().set_max_size(route_cache_size);
+  if (!routing_cache_filename.empty() && routing->cache().load(routing_cache_filename))
+    spdlog::info("Routing cache loaded from {} ({} entries)", routing_cache_filename, routing->cache().size());
+  if (matrix_routing && !matrix) {
+    matrix = std::make_shared<TravelMatrix>(travel_matrix_cell_size > 0.0 ? travel_matrix_cell_size : TravelMatrix::DEFAULT_CELL_SIZE);
+    if (matrix->build(*engine, instance)) {
+      matrix_routing->set_matrix(matrix);
+      if (!travel_matrix_filename.empty())
+        matrix->save(travel_matrix_filename);
+    }
   }
-  Hospital::source(is);
-  is.close();
-  
-  Time limit = (conf.end_time - conf.start_time).total_seconds();
+  if (data_filename.empty())
+    data_filename = data_sink == "sqlite" ? "default.sqlite3.db" : "default-data";
   
+  // each replication has its own simulation, configuration, random generator and entities,
+  // while the instance and the routing backend are shared (read-only)
+  auto run_replication = [&](unsigned int k) {
+    SimulationContext context(conf);
+    std::mt19937 rd(seed + k);
+    // this will use hardware entropy
+    //std::random_device rd;
+    context.conf.gen = std::default_random_engine{rd()};
+    if (vm.count("rescue-distance-threshold"))
+      context.distance_threshold = units::length::kilometer_t(dt);
+    if (vm.count("rescue-time-threshold"))
+      context.time_threshold = units::time::minute_t(tt);
+    if (vm.count("max-speed"))
+      context.max_speed = units::velocity::kilometers_per_hour_t(max_speed);
+    if (vm.count("routing-candidates"))
+      context.routing_candidates = routing_candidates;
+    context.colored = colored;
+    context.instance = &instance;
+    context.hospitals = instance.hospitals;
+    auto filename = replications > 1 ? replication_filename(data_filename, k) : data_filename;
+    std::unique_ptr<DataSink> sink;
+    if (data_sink == "sqlite")
+      sink = std::make_unique<SQLiteSink>(filename, sqlite_options, context, data_compact);
+    else if (data_sink == "csv")
+      sink = std::make_unique<CSVSink>(filename, context, data_compact);
+    else if (data_sink == "columnar")
+      sink = std::make_unique<ColumnarSink>(filename, context);
+    context.data = std::make_unique<SimulationData>(std::move(sink), data_options);
+    
+    simcpp20::simulation<Time> sim;
+    Dispatcher dispatcher(sim, context, *routing);
+    // the first arrival must be scheduled before the ambulance shifts (see Emergency::arrival_process)
+    Emergency::source(instance, sim, context, dispatcher);
+    Ambulance::source(instance, sim, context, dispatcher, *routing);
+    
 #ifdef LOGGING
-  spdlog::info("[{}] Simulation started", std::to_string(conf.start_time, sim.now()));
+    spdlog::info("[{}] Simulation {} started", std::to_string(context.conf.start_time, sim.now()), k);
 #endif
-  
-  if (progress)
-    manage_progress_bar(sim, conf);
-  
-  //  manage_emergencies(sim, conf, emergencies, available_ambulances, hospitals);
-  
-  //sim.run_until(limit);
-  sim.run();
+    
+    if (progress && replications == 1)
+      manage_progress_bar(sim, context.conf);
+    
+    //  manage_emergencies(sim, conf, emergencies, available_ambulances, hospitals);
+    
+    //sim.run_until(limit);
+    sim.run();
+    context.data->close();
+    context.metrics->log_summary();
+    const auto& batches = dispatcher.routing_batch().statistics();
+    spdlog::info("Routing batches: {} tables for {} requests ({} pairs), {} pairs computed outside of a batch", batches.batches, batches.requests, batches.pairs, batches.misses);
+    spdlog::info("Candidate ambulances: {} routed of {}", dispatcher.statistics().routed_candidates, dispatcher.statistics().candidates);
+    if (context.conf.position_reference) {
+      const auto& s = dispatcher.statistics();
+      spdlog::info("Position models: {} of {} dispatch decisions differ from the {} reference", s.position_differences, s.position_decisions, position_reference);
+      spdlog::info("Position models: {:.3f} km mean and {:.3f} km maximum distance over {} positions of moving ambulances", s.mean_position_error().value(), s.max_position_error.value(), s.position_errors);
+    }
+    if (!metrics_filename.empty()) {
+      auto name = replications > 1 ? replication_filename(metrics_filename, k) : metrics_filename;
+      std::ofstream os(name);
+      if (!os)
+      {
+        throw std::logic_error("Could not open metrics file " + name);
+        return;
+      }
+      context.metrics->write_json(os);
+    }
 #ifdef LOGGING
-  spdlog::info("[{}] Simulation ended", std::to_string(conf.start_time, sim.now()));
+    spdlog::info("[{}] Simulation {} ended", std::to_string(context.conf.start_time, sim.now()), k);
 #endif
+  };
+  
+  std::atomic<unsigned int> next_replication(0);
+  std::vector<std::exception_ptr> errors(replications);
+  auto worker = [&]() {
+    for (unsigned int k = next_replication++; k < replications; k = next_replication++) {
+      try {
+        run_replication(k);
+      } catch (...) {
+        errors[k] = std::current_exception();
+      }
+    }
+  };
+  if (threads <= 1 || replications == 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < std::min(threads, replications); i++)
+      pool.emplace_back(worker);
+    for (auto& t : pool)
+      t.join();
+  }
+  for (const auto& e : errors)
+    if (e)
+      std::rethrow_exception(e);
+  routing->log_statistics();
+  if (!routing_cache_filename.empty())
+    routing->cache().save(routing_cache_filename);
   
   //  while (emergencies.size() > 0)
   //  {
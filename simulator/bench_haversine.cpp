@@ -0,0 +1,114 @@
+#include "data.hpp"
+#include "routing.hpp"
+#include "coordinate_batch.hpp"
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+// Micro-benchmark of the batched haversine computations of the dispatcher:
+// the pairwise Routing::haversine loop, the scalar fallback of CoordinateBatch
+// and its vectorized kernel (AVX2 or NEON, when available). The distances and
+// the threshold masks of the batch are checked against Routing::haversine.
+int main(int argc, const char *argv[])
+{
+  std::size_t points = 256, repetitions = 20000;
+  double threshold = 20.0, tolerance = 0.01;
+  unsigned int seed = 0;
+  po::options_description desc("Command line options");
+  desc.add_options()("help,?", "print usage message")
+  ("points,n", po::value(&points), "Number of coordinates in the batch")
+  ("repetitions,r", po::value(&repetitions), "Number of queries (each one against the whole batch)")
+  ("threshold,t", po::value(&threshold), "Distance threshold of the masks (in km)")
+  ("tolerance", po::value(&tolerance), "Largest accepted difference from Routing::haversine (in km)")
+  ("seed,s", po::value(&seed), "Random seed");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") || points == 0 || repetitions == 0) {
+    std::cerr << desc << "\n";
+    return 1;
+  }
+
+  // coordinates spread over a region of about 150 x 100 km, as the bases and the emergencies of an instance
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> lat_dist(45.0, 46.0), lon_dist(8.5, 10.5);
+  auto random_coordinate = [&]() { return Coordinate{osrm::util::FloatLongitude{lon_dist(gen)}, osrm::util::FloatLatitude{lat_dist(gen)}}; };
+  std::vector<Coordinate> coordinates(points), queries(std::min<std::size_t>(repetitions, 1024));
+  CoordinateBatch batch;
+  for (auto& c : coordinates) {
+    c = random_coordinate();
+    batch.push_back(c);
+  }
+  for (auto& q : queries)
+    q = random_coordinate();
+  auto t_threshold = units::length::kilometer_t(threshold);
+
+  // the checksum prevents the compiler from dropping the computations
+  auto measure = [&](const std::string& name, auto f) {
+    std::size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < repetitions; r++)
+      checksum += f(queries[r % queries.size()]);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{:<24} {:8.3f} ms, {:8.1f} Mpairs/s (checksum {})", name, 1000.0 * elapsed, points * repetitions / elapsed / 1e6, checksum);
+  };
+  std::vector<float> distances;
+  std::vector<std::uint8_t> mask;
+  measure("Routing::haversine", [&](const Coordinate& q) {
+    std::size_t close = 0;
+    for (const auto& c : coordinates)
+      close += Routing::haversine(q, c) < t_threshold;
+    return close;
+  });
+  for (bool vectorized : { false, true }) {
+    CoordinateBatch::set_vectorized(vectorized);
+    if (vectorized && !CoordinateBatch::vectorized()) {
+      spdlog::info("No vectorized kernel available on this machine");
+      break;
+    }
+    std::string kernel = vectorized ? "vectorized" : "scalar";
+    measure("distances (" + kernel + ")", [&](const Coordinate& q) {
+      batch.distances(q, distances);
+      return std::size_t(distances[0] > 0.0f);
+    });
+    measure("within (" + kernel + ")", [&](const Coordinate& q) {
+      batch.within(q, t_threshold, mask);
+      std::size_t close = 0;
+      for (auto m : mask)
+        close += m;
+      return close;
+    });
+  }
+
+  // both kernels must agree with the pairwise computation, the masks may only differ at the threshold
+  bool valid = true;
+  for (bool vectorized : { false, true }) {
+    CoordinateBatch::set_vectorized(vectorized);
+    if (vectorized && !CoordinateBatch::vectorized())
+      break;
+    double max_error = 0.0;
+    std::size_t mask_errors = 0;
+    for (const auto& q : queries) {
+      batch.distances(q, distances);
+      batch.within(q, t_threshold, mask);
+      for (std::size_t i = 0; i < points; i++) {
+        double exact = Routing::haversine(q, coordinates[i]).value();
+        max_error = std::max(max_error, std::abs(exact - distances[i]));
+        if (bool(mask[i]) != (exact < threshold) && std::abs(exact - threshold) > tolerance)
+          mask_errors++;
+      }
+    }
+    spdlog::info("{} kernel: largest distance error {:.6f} km, {} wrong mask entries", vectorized ? "Vectorized" : "Scalar", max_error, mask_errors);
+    valid = valid && max_error <= tolerance && mask_errors == 0;
+  }
+  CoordinateBatch::set_vectorized(true);
+  if (!valid) {
+    spdlog::error("The batched distances do not match Routing::haversine");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "data.hpp"
+#include "helpers.hpp"
+#include "ambulance.hpp"
+#include "hospital.hpp"
+#include "instance.hpp"
+#include "sqlite_sink.hpp"
+#include "csv_sink.hpp"
+#include "columnar_sink.hpp"
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <filesystem>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+// Throughput benchmark of the simulation data sinks: the same synthetic
+// records (one rescue and one ambulance state every four ambulance events)
+// are written to the SQLite, CSV and columnar sinks, committed in batches as
+// the writer thread of SimulationData does.
+int main(int argc, const char *argv[])
+{
+  std::size_t records = 1000000, batch_size = SimulationData::Options().batch_size, ambulances = 100, hospitals = 20;
+  std::string directory = "bench-sinks";
+  bool compact = false, wal = false, no_sync = false;
+  unsigned int seed = 0;
+  po::options_description desc("Command line options");
+  desc.add_options()("help,?", "print usage message")
+  ("records,n", po::value(&records), "Number of records written to each sink")
+  ("batch-size", po::value(&batch_size), "Number of records committed at once")
+  ("output,o", po::value(&directory), "Directory of the written data (overwritten)")
+  ("compact", po::bool_switch(&compact), "Use the compact format in the SQLite and CSV sinks")
+  ("wal", po::bool_switch(&wal), "Use write-ahead logging for the SQLite sink")
+  ("no-sync", po::bool_switch(&no_sync), "Do not wait for the SQLite writes to reach the disk")
+  ("seed,s", po::value(&seed), "Random seed");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") || records == 0 || batch_size == 0) {
+    std::cerr << desc << "\n";
+    return 1;
+  }
+
+  // a context with as many entities as the records refer to
+  config conf;
+  conf.start_time = pt::time_from_string("2024-01-01 00:00:00");
+  conf.end_time = conf.start_time + pt::hours(24 * 7);
+  conf.preemptable = true;
+  conf.position_model = PositionModel::LINEAR;
+  SimulationContext context(conf);
+  Instance instance;
+  std::size_t rescues = records / 6 + 1;
+  instance.emergencies.resize(rescues);
+  for (std::size_t i = 0; i < rescues; i++)
+    instance.emergencies[i].id = "E" + std::to_string(i);
+  context.instance = &instance;
+  for (std::size_t i = 0; i < hospitals; i++) {
+    auto h = std::make_shared<Hospital>();
+    h->index = i;
+    h->id = "H" + std::to_string(i);
+    context.hospitals.push_back(h);
+  }
+  // the sinks read the identifiers of the ambulances from the instance
+  instance.ambulances.resize(ambulances);
+  for (std::size_t i = 0; i < ambulances; i++)
+    instance.ambulances[i].id = "A" + std::to_string(i);
+
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<std::int32_t> ambulance_dist(0, std::int32_t(ambulances) - 1), hospital_dist(-1, std::int32_t(hospitals) - 1);
+  std::uniform_int_distribution<int> state_dist(Ambulance::UNAVAILABLE, Ambulance::PREEMPTED), triage_dist(Emergency::RED, Emergency::WHITE);
+  std::vector<DataRecord> data(records);
+  // the first rescue starts at the beginning of the simulation
+  Time now = 1800;
+  std::int32_t emergency = 0;
+  for (std::size_t i = 0; i < records; i++) {
+    now += 60;
+    switch (i % 6) {
+      case 0:
+        data[i] = DataRecord{ DataRecord::RESCUE, std::uint8_t(triage_dist(gen)), ambulance_dist(gen), emergency++, hospital_dist(gen), { now - 1800, now - 1500, now - 900, now } };
+        break;
+      case 5:
+        data[i] = DataRecord{ DataRecord::AMBULANCE_STATE, std::uint8_t(state_dist(gen)), ambulance_dist(gen), -1, -1, { now } };
+        break;
+      default:
+        data[i] = DataRecord{ DataRecord::AMBULANCE_EVENT, std::uint8_t(state_dist(gen)), ambulance_dist(gen), std::max(emergency - 1, 0), -1, { now } };
+        break;
+    }
+  }
+
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  auto measure = [&](const std::string& name, std::unique_ptr<DataSink> sink) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t batch_rows = 0;
+    for (const auto& r : data) {
+      sink->write(r);
+      if (++batch_rows == batch_size) {
+        sink->commit();
+        batch_rows = 0;
+      }
+    }
+    sink->commit();
+    // closing the sink flushes the buffered data
+    sink.reset();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{:<10} {:10.3f} s, {:12.0f} records/s", name, elapsed, records / elapsed);
+  };
+  SQLiteSink::Options sqlite_options;
+  sqlite_options.wal = wal;
+  sqlite_options.synchronous = !no_sync;
+  measure("sqlite", std::make_unique<SQLiteSink>((std::filesystem::path(directory) / "data.sqlite3.db").string(), sqlite_options, context, compact));
+  measure("csv", std::make_unique<CSVSink>((std::filesystem::path(directory) / "csv").string(), context, compact));
+  measure("columnar", std::make_unique<ColumnarSink>((std::filesystem::path(directory) / "columnar").string(), context));
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "columnar_sink.hpp"
+#include <bit>
+#include <iostream>
+#include <type_traits>
+
+template <typename T>
+NpyColumn<T>::NpyColumn(const std::filesystem::path& path) : path(path), file(path, std::ios::binary), rows(0) {
+  if (!file)
+    throw std::logic_error("Could not open data file " + path.string());
+  write_header();
+}
+
+template <typename T>
+NpyColumn<T>::~NpyColumn() {
+  flush();
+  file.seekp(0);
+  write_header();
+}
+
+template <typename T>
+void NpyColumn<T>::write_header() {
+  // format version 1.0: magic string, version, header length and the array description
+  // padded with spaces (and terminated by a newline) so that data is aligned
+  std::string descr;
+  descr += std::endian::native == std::endian::little ? '<' : '>';
+  descr += std::is_signed_v<T> ? 'i' : 'u';
+  descr += std::to_string(sizeof(T));
+  std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" + std::to_string(rows) + ",), }";
+  header.resize(HEADER_SIZE - 11, ' ');
+  header += '\n';
+  const std::uint16_t length = header.size();
+  file.write("\x93NUMPY\x01\x00", 8);
+  file.put(char(length & 0xff));
+  file.put(char(length >> 8));
+  file << header;
+}
+
+template <typename T>
+void NpyColumn<T>::flush() {
+  file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(T));
+  rows += chunk.size();
+  chunk.clear();
+  if (!file)
+    std::cerr << "ERROR in data logging (commit) on " << path << std::endl;
+}
+
+template <typename T>
+std::unique_ptr<NpyColumn<T>> ColumnarSink::column(const std::string& name) const {
+  return std::make_unique<NpyColumn<T>>(std::filesystem::path(directory) / (name + ".npy"));
+}
+
+ColumnarSink::ColumnarSink(const std::string& directory, const SimulationContext& context) : DataSink(context, true), directory(directory) {
+  std::filesystem::create_directories(directory);
+  rescue_emergency = column<std::int32_t>("rescue.emergency");
+  rescue_ambulance = column<std::int32_t>("rescue.ambulance");
+  rescue_hospital = column<std::int32_t>("rescue.hospital");
+  rescue_triage = column<std::uint8_t>("rescue.triage");
+  rescue_call = column<std::int64_t>("rescue.call");
+  rescue_start = column<std::int64_t>("rescue.start");
+  rescue_at_emergency = column<std::int64_t>("rescue.at_emergency");
+  rescue_at_hospital = column<std::int64_t>("rescue.at_hospital");
+  event_ambulance = column<std::int32_t>("ambulance_event.ambulance");
+  event_emergency = column<std::int32_t>("ambulance_event.emergency");
+  event_state = column<std::uint8_t>("ambulance_event.state");
+  event_time = column<std::int64_t>("ambulance_event.time");
+  for (auto entity : { EMERGENCY, AMBULANCE, HOSPITAL }) {
+    codes[entity].open(std::filesystem::path(directory) / (std::string(code_table(entity)) + ".csv"));
+    codes[entity] << "code,id\n";
+  }
+  write_lookup_files(directory);
+}
+
+void ColumnarSink::write_code(Entity entity, std::int32_t code, const std::string& id) {
+  codes[entity] << code << ",";
+  write_csv_field(codes[entity], id);
+  codes[entity] << "\n";
+}
+
+void ColumnarSink::write(const DataRecord& r) {
+  switch (r.kind) {
+    case DataRecord::RESCUE:
+      rescue_emergency->push_back(code(EMERGENCY, r.emergency));
+      rescue_ambulance->push_back(code(AMBULANCE, r.ambulance));
+      rescue_hospital->push_back(r.hospital >= 0 ? code(HOSPITAL, r.hospital) : -1);
+      rescue_triage->push_back(r.state);
+      rescue_call->push_back(r.times[0]);
+      rescue_start->push_back(r.times[1]);
+      rescue_at_emergency->push_back(r.times[2]);
+      rescue_at_hospital->push_back(r.hospital >= 0 ? r.times[3] : -1);
+      break;
+    case DataRecord::AMBULANCE_EVENT:
+    case DataRecord::AMBULANCE_STATE:
+      event_ambulance->push_back(code(AMBULANCE, r.ambulance));
+      event_emergency->push_back(r.kind == DataRecord::AMBULANCE_EVENT ? code(EMERGENCY, r.emergency) : -1);
+      event_state->push_back(r.state);
+      event_time->push_back(r.times[0]);
+      break;
+  }
+}
+
+void ColumnarSink::commit() {
+  for (auto c : { rescue_emergency.get(), rescue_ambulance.get(), rescue_hospital.get(), event_ambulance.get(), event_emergency.get() })
+    c->flush();
+  for (auto c : { rescue_triage.get(), event_state.get() })
+    c->flush();
+  for (auto c : { rescue_call.get(), rescue_start.get(), rescue_at_emergency.get(), rescue_at_hospital.get(), event_time.get() })
+    c->flush();
+  for (auto& os : codes)
+    os.flush();
+}
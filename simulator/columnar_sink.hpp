@@ -0,0 +1,51 @@
+#pragma once
+
+#include "data_sink.hpp"
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+// A column of fixed-size values stored as a one-dimensional NumPy (.npy)
+// array. Values are buffered and appended to the file a chunk at a time, the
+// header (which holds the number of rows) is rewritten when the column is
+// closed.
+template <typename T>
+class NpyColumn {
+public:
+  NpyColumn(const std::filesystem::path& path);
+  ~NpyColumn();
+  inline void push_back(T value) { chunk.push_back(value); }
+  // appends the buffered values to the file
+  void flush();
+protected:
+  static constexpr std::size_t HEADER_SIZE = 128;
+  void write_header();
+  std::filesystem::path path;
+  std::ofstream file;
+  std::size_t rows;
+  std::vector<T> chunk;
+};
+
+// Simulation data as columns, one NumPy file for each column of the rescue
+// and ambulance_event tables (e.g., rescue.call.npy) in the given directory,
+// so that they can be loaded as arrays or dataframes with no parsing. Data is
+// always compact: the lookup tables are written as CSV files, missing codes
+// and times are stored as -1.
+class ColumnarSink : public DataSink {
+public:
+  ColumnarSink(const std::string& directory, const SimulationContext& context);
+  void write(const DataRecord& r) override;
+  void commit() override;
+protected:
+  void write_code(Entity entity, std::int32_t code, const std::string& id) override;
+  template <typename T>
+  std::unique_ptr<NpyColumn<T>> column(const std::string& name) const;
+  std::string directory;
+  std::unique_ptr<NpyColumn<std::int32_t>> rescue_emergency, rescue_ambulance, rescue_hospital;
+  std::unique_ptr<NpyColumn<std::uint8_t>> rescue_triage;
+  std::unique_ptr<NpyColumn<std::int64_t>> rescue_call, rescue_start, rescue_at_emergency, rescue_at_hospital;
+  std::unique_ptr<NpyColumn<std::int32_t>> event_ambulance, event_emergency;
+  std::unique_ptr<NpyColumn<std::uint8_t>> event_state;
+  std::unique_ptr<NpyColumn<std::int64_t>> event_time;
+  std::ofstream codes[HOSPITAL + 1];
+};
@@ -0,0 +1,60 @@
+#include "data.hpp"
+#include "instance.hpp"
+#include <iostream>
+#include <fstream>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+// Compiles the emergencies, ambulances and hospitals files of an instance
+// into a binary instance file, to be loaded by the simulator with --instance.
+int main(int argc, const char *argv[])
+{
+  std::string emergencies_filename, ambulances_filename, hospitals_filename, output_filename;
+  po::options_description desc("Command line options");
+  desc.add_options()("help,?", "print usage message")
+  ("emergencies,e", po::value(&emergencies_filename), "Emergencies file (TXT or CSV format)")
+  ("ambulances,a", po::value(&ambulances_filename), "Ambulances file")
+  ("hospitals,h", po::value(&hospitals_filename), "Hospital file")
+  ("output,o", po::value(&output_filename), "Binary instance file");
+  
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") || !vm.count("emergencies") || !vm.count("ambulances") || !vm.count("hospitals") || !vm.count("output")) {
+    std::cerr << desc << "\n";
+    return 1;
+  }
+  
+  Instance instance;
+  std::ifstream is;
+  if (!instance.load_emergencies(emergencies_filename))
+  {
+    throw std::logic_error("Could not open emergencies file " + emergencies_filename);
+    return -1;
+  }
+  is.open(ambulances_filename);
+  if (!is)
+  {
+    throw std::logic_error("Could not open ambulances file " + ambulances_filename);
+    return -1;
+  }
+  instance.read_ambulances(is);
+  is.close();
+  is.open(hospitals_filename);
+  if (!is)
+  {
+    throw std::logic_error("Could not open hospitals file " + hospitals_filename);
+    return -1;
+  }
+  instance.read_hospitals(is);
+  is.close();
+  
+  if (!instance.save(output_filename))
+  {
+    throw std::logic_error("Could not write instance file " + output_filename);
+    return -1;
+  }
+  spdlog::info("Instance written to {} ({} emergencies, {} ambulances, {} hospitals)", output_filename, instance.emergencies.size(), instance.ambulances.size(), instance.hospitals.size());
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include "coordinate_batch.hpp"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BATCH_NEON 1
+#endif
+
+// radius (in km) of the sphere used by Routing::haversine
+const float EARTH_RADIUS = 6371.0f;
+const float PI_F = float(M_PI);
+const float DEG_TO_RAD = float(M_PI / 180.0);
+
+// Taylor coefficients of sin(x), the error is below 1e-7 on [0, pi/2]
+const float S3 = -1.0f / 6.0f, S5 = 1.0f / 120.0f, S7 = -1.0f / 5040.0f, S9 = 1.0f / 362880.0f, S11 = -1.0f / 39916800.0f;
+// asin(x) = pi/2 - sqrt(1 - x) * (A0 + A1 x + ... + A7 x^7) on [0, 1], error below 2e-8 (Abramowitz and Stegun, 4.4.46)
+const float A0 = 1.5707963050f, A1 = -0.2145988016f, A2 = 0.0889789874f, A3 = -0.0501743046f, A4 = 0.0308918810f, A5 = -0.0170881256f, A6 = 0.0066700901f, A7 = -0.0012624911f;
+
+void CoordinateBatch::push_back(const Coordinate& c)
+{
+  lats.push_back(float(c.lat.__value * M_PI / 180.0));
+  lons.push_back(float(c.lon.__value * M_PI / 180.0));
+  cos_lats.push_back(float(std::cos(c.lat.__value * M_PI / 180.0)));
+}
+
+void CoordinateBatch::clear()
+{
+  lats.clear(); lons.clear(); cos_lats.clear();
+}
+
+// sin^2(d / 2), for d in [-2 pi, 2 pi]
+static inline float sin2_half(float d)
+{
+  float x = std::fabs(0.5f * d);
+  x = std::min(x, PI_F - x);
+  float x2 = x * x;
+  float s = x * (1.0f + x2 * (S3 + x2 * (S5 + x2 * (S7 + x2 * (S9 + x2 * S11)))));
+  return s * s;
+}
+
+// central angle from the haversine term a
+static inline float central_angle(float a)
+{
+  float x = std::sqrt(std::min(std::max(a, 0.0f), 1.0f));
+  float p = A0 + x * (A1 + x * (A2 + x * (A3 + x * (A4 + x * (A5 + x * (A6 + x * A7))))));
+  return 2.0f * (0.5f * PI_F - std::sqrt(1.0f - x) * p);
+}
+
+// The kernels compute the haversine term a of the points [begin, n) and return
+// the first point they did not process (the remaining ones are left to the scalar loop).
+// When distance is set, a is converted to the distance in km.
+
+#ifdef BATCH_AVX2
+__attribute__((target("avx2,fma")))
+static inline __m256 sin2_half_avx2(__m256 d)
+{
+  const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  __m256 x = _mm256_andnot_ps(sign_mask, _mm256_mul_ps(_mm256_set1_ps(0.5f), d));
+  x = _mm256_min_ps(x, _mm256_sub_ps(_mm256_set1_ps(PI_F), x));
+  __m256 x2 = _mm256_mul_ps(x, x);
+  __m256 p = _mm256_fmadd_ps(x2, _mm256_set1_ps(S11), _mm256_set1_ps(S9));
+  p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(S7));
+  p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(S5));
+  p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(S3));
+  p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(1.0f));
+  __m256 s = _mm256_mul_ps(x, p);
+  return _mm256_mul_ps(s, s);
+}
+
+__attribute__((target("avx2,fma")))
+static std::size_t haversine_avx2(const float* lats, const float* lons, const float* cos_lats, std::size_t n, float lat, float lon, float cos_lat, bool distance, float* result)
+{
+  const __m256 vlat = _mm256_set1_ps(lat), vlon = _mm256_set1_ps(lon), vcos = _mm256_set1_ps(cos_lat);
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256 slat = sin2_half_avx2(_mm256_sub_ps(_mm256_loadu_ps(lats + i), vlat));
+    __m256 slon = sin2_half_avx2(_mm256_sub_ps(_mm256_loadu_ps(lons + i), vlon));
+    __m256 a = _mm256_fmadd_ps(_mm256_mul_ps(vcos, _mm256_loadu_ps(cos_lats + i)), slon, slat);
+    if (distance)
+    {
+      __m256 x = _mm256_sqrt_ps(_mm256_min_ps(_mm256_max_ps(a, _mm256_setzero_ps()), _mm256_set1_ps(1.0f)));
+      __m256 p = _mm256_fmadd_ps(x, _mm256_set1_ps(A7), _mm256_set1_ps(A6));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A5));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A4));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A3));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A2));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A1));
+      p = _mm256_fmadd_ps(x, p, _mm256_set1_ps(A0));
+      __m256 angle = _mm256_fnmadd_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), x)), p, _mm256_set1_ps(0.5f * PI_F));
+      a = _mm256_mul_ps(angle, _mm256_set1_ps(2.0f * EARTH_RADIUS));
+    }
+    _mm256_storeu_ps(result + i, a);
+  }
+  return i;
+}
+
+static bool use_avx2()
+{
+  static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+}
+#endif
+
+#ifdef BATCH_NEON
+static inline float32x4_t sin2_half_neon(float32x4_t d)
+{
+  float32x4_t x = vabsq_f32(vmulq_n_f32(d, 0.5f));
+  x = vminq_f32(x, vsubq_f32(vdupq_n_f32(PI_F), x));
+  float32x4_t x2 = vmulq_f32(x, x);
+  float32x4_t p = vfmaq_f32(vdupq_n_f32(S9), x2, vdupq_n_f32(S11));
+  p = vfmaq_f32(vdupq_n_f32(S7), x2, p);
+  p = vfmaq_f32(vdupq_n_f32(S5), x2, p);
+  p = vfmaq_f32(vdupq_n_f32(S3), x2, p);
+  p = vfmaq_f32(vdupq_n_f32(1.0f), x2, p);
+  float32x4_t s = vmulq_f32(x, p);
+  return vmulq_f32(s, s);
+}
+
+static std::size_t haversine_neon(const float* lats, const float* lons, const float* cos_lats, std::size_t n, float lat, float lon, float cos_lat, bool distance, float* result)
+{
+  const float32x4_t vlat = vdupq_n_f32(lat), vlon = vdupq_n_f32(lon), vcos = vdupq_n_f32(cos_lat);
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    float32x4_t slat = sin2_half_neon(vsubq_f32(vld1q_f32(lats + i), vlat));
+    float32x4_t slon = sin2_half_neon(vsubq_f32(vld1q_f32(lons + i), vlon));
+    float32x4_t a = vfmaq_f32(slat, vmulq_f32(vcos, vld1q_f32(cos_lats + i)), slon);
+    if (distance)
+    {
+      float32x4_t x = vsqrtq_f32(vminq_f32(vmaxq_f32(a, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f)));
+      float32x4_t p = vfmaq_f32(vdupq_n_f32(A6), x, vdupq_n_f32(A7));
+      p = vfmaq_f32(vdupq_n_f32(A5), x, p);
+      p = vfmaq_f32(vdupq_n_f32(A4), x, p);
+      p = vfmaq_f32(vdupq_n_f32(A3), x, p);
+      p = vfmaq_f32(vdupq_n_f32(A2), x, p);
+      p = vfmaq_f32(vdupq_n_f32(A1), x, p);
+      p = vfmaq_f32(vdupq_n_f32(A0), x, p);
+      float32x4_t angle = vfmsq_f32(vdupq_n_f32(0.5f * PI_F), vsqrtq_f32(vsubq_f32(vdupq_n_f32(1.0f), x)), p);
+      a = vmulq_n_f32(angle, 2.0f * EARTH_RADIUS);
+    }
+    vst1q_f32(result + i, a);
+  }
+  return i;
+}
+#endif
+
+// the kernels are selected for the whole process, they are only disabled by the benchmarks
+static bool vectorized_kernels = true;
+
+void CoordinateBatch::set_vectorized(bool enabled)
+{
+  vectorized_kernels = enabled;
+}
+
+bool CoordinateBatch::vectorized()
+{
+#if defined(BATCH_AVX2)
+  return vectorized_kernels && use_avx2();
+#elif defined(BATCH_NEON)
+  return vectorized_kernels;
+#else
+  return false;
+#endif
+}
+
+static void haversine_batch(const std::vector<float>& lats, const std::vector<float>& lons, const std::vector<float>& cos_lats, const Coordinate& c, bool distance, float* result)
+{
+  const float lat = float(c.lat.__value * M_PI / 180.0), lon = float(c.lon.__value * M_PI / 180.0), cos_lat = float(std::cos(c.lat.__value * M_PI / 180.0));
+  const std::size_t n = lats.size();
+  std::size_t i = 0;
+#ifdef BATCH_AVX2
+  if (CoordinateBatch::vectorized())
+    i = haversine_avx2(lats.data(), lons.data(), cos_lats.data(), n, lat, lon, cos_lat, distance, result);
+#endif
+#ifdef BATCH_NEON
+  if (CoordinateBatch::vectorized())
+    i = haversine_neon(lats.data(), lons.data(), cos_lats.data(), n, lat, lon, cos_lat, distance, result);
+#endif
+  for (; i < n; i++)
+  {
+    float a = sin2_half(lats[i] - lat) + cos_lat * cos_lats[i] * sin2_half(lons[i] - lon);
+    result[i] = distance ? EARTH_RADIUS * central_angle(a) : a;
+  }
+}
+
+void CoordinateBatch::distances(const Coordinate& c, std::vector<float>& result) const
+{
+  result.resize(size());
+  haversine_batch(lats, lons, cos_lats, c, true, result.data());
+}
+
+void CoordinateBatch::within(const Coordinate& c, units::length::kilometer_t threshold, std::vector<std::uint8_t>& mask) const
+{
+  // d < threshold iff a < sin^2(threshold / 2R), so no inverse trigonometric function is needed
+  double limit = std::sin(std::min(threshold.value() / (2.0 * EARTH_RADIUS), M_PI / 2.0));
+  float a_threshold = float(limit * limit);
+  std::vector<float> a(size());
+  haversine_batch(lats, lons, cos_lats, c, false, a.data());
+  mask.resize(size());
+  for (std::size_t i = 0; i < size(); i++)
+    mask[i] = a[i] < a_threshold;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "routing.hpp"
+#include <vector>
+#include <cstdint>
+
+// Structure-of-arrays of coordinates for the batched haversine computations
+// of the dispatcher. Latitudes and longitudes are stored in radians (single
+// precision, i.e., below one meter) together with the cosine of the latitude,
+// so that the distances from a point to all the coordinates of the batch are
+// computed without trigonometric library calls. The kernel is vectorized with
+// AVX2 (selected at runtime) or NEON, with a scalar fallback.
+class CoordinateBatch {
+public:
+  void push_back(const Coordinate& c);
+  void clear();
+  inline std::size_t size() const { return lats.size(); }
+  inline bool empty() const { return lats.empty(); }
+
+  // haversine distances (in km) from c to each coordinate of the batch
+  void distances(const Coordinate& c, std::vector<float>& result) const;
+  // mask[i] is set iff the haversine distance from c to the i-th coordinate is below threshold
+  void within(const Coordinate& c, units::length::kilometer_t threshold, std::vector<std::uint8_t>& mask) const;
+  
+  // the vectorized kernels can be disabled (e.g., to compare them with the scalar fallback)
+  static void set_vectorized(bool enabled);
+  static bool vectorized();
+protected:
+  std::vector<float> lats, lons, cos_lats;
+};
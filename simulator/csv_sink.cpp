@@ -0,0 +1,95 @@
+#include "csv_sink.hpp"
+#include "helpers.hpp"
+#include <filesystem>
+
+static void open_file(std::ofstream& os, const std::filesystem::path& path) {
+  os.open(path);
+  if (!os)
+    throw std::logic_error("Could not open data file " + path.string());
+}
+
+CSVSink::CSVSink(const std::string& directory, const SimulationContext& context, bool compact) : DataSink(context, compact), directory(directory) {
+  std::filesystem::create_directories(directory);
+  open_file(rescue, std::filesystem::path(directory) / "rescue.csv");
+  open_file(ambulance_event, std::filesystem::path(directory) / "ambulance_event.csv");
+  rescue << "emergency,ambulance,hospital,triage,call,start,at_emergency,at_hospital\n";
+  ambulance_event << "ambulance,emergency,state,time\n";
+  if (compact) {
+    for (auto entity : { EMERGENCY, AMBULANCE, HOSPITAL }) {
+      open_file(codes[entity], std::filesystem::path(directory) / (std::string(code_table(entity)) + ".csv"));
+      codes[entity] << "code,id\n";
+    }
+    write_lookup_files(directory);
+  }
+}
+
+void CSVSink::write_code(Entity entity, std::int32_t code, const std::string& id) {
+  codes[entity] << code << ",";
+  write_csv_field(codes[entity], id);
+  codes[entity] << "\n";
+}
+
+void CSVSink::write_time(std::ostream& os, Time t) {
+  if (compact)
+    os << t;
+  else
+    os << std::to_string(context.conf.start_time, t);
+}
+
+void CSVSink::write_entity(std::ostream& os, Entity entity, std::int32_t index) {
+  if (index < 0)
+    return;
+  if (compact)
+    os << code(entity, index);
+  else
+    write_csv_field(os, id(entity, index));
+}
+
+void CSVSink::write(const DataRecord& r) {
+  switch (r.kind) {
+    case DataRecord::RESCUE:
+      write_entity(rescue, EMERGENCY, r.emergency);
+      rescue << ",";
+      write_entity(rescue, AMBULANCE, r.ambulance);
+      rescue << ",";
+      write_entity(rescue, HOSPITAL, r.hospital);
+      rescue << ",";
+      if (compact)
+        rescue << int(r.state);
+      else
+        rescue << Emergency::Code(r.state);
+      for (int i = 0; i < 3; i++) {
+        rescue << ",";
+        write_time(rescue, r.times[i]);
+      }
+      rescue << ",";
+      if (r.hospital >= 0)
+        write_time(rescue, r.times[3]);
+      rescue << "\n";
+      break;
+    case DataRecord::AMBULANCE_EVENT:
+    case DataRecord::AMBULANCE_STATE:
+      write_entity(ambulance_event, AMBULANCE, r.ambulance);
+      ambulance_event << ",";
+      write_entity(ambulance_event, EMERGENCY, r.kind == DataRecord::AMBULANCE_EVENT ? r.emergency : -1);
+      ambulance_event << ",";
+      if (compact)
+        ambulance_event << int(r.state);
+      else
+        ambulance_event << std::to_string(Ambulance::State(r.state));
+      ambulance_event << ",";
+      write_time(ambulance_event, r.times[0]);
+      ambulance_event << "\n";
+      break;
+  }
+}
+
+void CSVSink::commit() {
+  rescue.flush();
+  ambulance_event.flush();
+  for (auto& os : codes)
+    if (os.is_open())
+      os.flush();
+  if (!rescue || !ambulance_event)
+    std::cerr << "ERROR in data logging (commit) on " << directory << std::endl;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "data_sink.hpp"
+#include <fstream>
+
+// Simulation data as CSV files (rescue.csv and ambulance_event.csv, plus the
+// lookup tables in compact mode) in the given directory, with the same
+// columns of the SQLite tables. Missing values are empty fields.
+class CSVSink : public DataSink {
+public:
+  CSVSink(const std::string& directory, const SimulationContext& context, bool compact);
+  void write(const DataRecord& r) override;
+  void commit() override;
+protected:
+  void write_code(Entity entity, std::int32_t code, const std::string& id) override;
+  void write_time(std::ostream& os, Time t);
+  void write_entity(std::ostream& os, Entity entity, std::int32_t index);
+  std::string directory;
+  std::ofstream rescue, ambulance_event;
+  std::ofstream codes[HOSPITAL + 1];
+};
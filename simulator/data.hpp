@@ -5,13 +5,24 @@
 #include "spdlog/spdlog.h"
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <random>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include "simcpp20/simcpp20.hpp"
+#include "units.h"
 
 namespace pt = boost::posix_time;
 
 typedef long long Time;
 
-extern bool colored;
+// How the position of a travelling ambulance is computed: by walking the steps
+// of the route of the travel, requested for each travel, with their own
+// durations (exact, the position is the start of the next step), on the
+// straight line between its end points, without any routing request (linear),
+// or interpolated along a route shared by the travels between the same places
+// (route-cached)
+enum class PositionModel { EXACT, LINEAR, ROUTE_CACHED };
 
 struct config
 {
@@ -26,12 +37,52 @@ struct config
   std::string hospitals_filename;
   std::string osrm_filename;
   bool preemptable;
+  PositionModel position_model;
+  // when set, dispatch decisions are also evaluated with this model and the differences are counted
+  std::optional<PositionModel> position_reference;
+};
+
+class Emergency;
+class Ambulance;
+class Hospital;
+class SimulationData;
+class Metrics;
+class Instance;
+
+// State of a single simulation: configuration, dispatching parameters, entity
+// registries, output data and performance indicators. Each simulation has its own context, so several
+// simulations (e.g., replications) can coexist in the same process.
+struct SimulationContext
+{
+  SimulationContext(const config& conf);
+  ~SimulationContext();
+  config conf;
+  units::length::kilometer_t distance_threshold;
+  units::time::minute_t time_threshold;
+  // maximum speed on the road network, for the lower bound of the travel times (zero disables the pruning of the candidates)
+  units::velocity::kilometers_per_hour_t max_speed;
+  // number of candidate ambulances routed at once, best first
+  std::size_t routing_candidates;
+  bool colored;
+  // the simulated instance, not modified by the simulation (it can be shared among contexts)
+  const Instance* instance;
+  // emergencies are allocated from a pool, so that the memory of the ended ones is reused
+  std::pmr::unsynchronized_pool_resource emergency_pool;
+  // emergencies are indexed as the instance records, the slot is empty before the
+  // emergency occurs and after it ends
+  std::vector<std::shared_ptr<Emergency>> emergencies;
+  std::vector<std::shared_ptr<Ambulance>> ambulances;
+  // hospitals are not modified by the simulation, they can be shared among contexts
+  std::vector<std::shared_ptr<Hospital>> hospitals;
+  std::unique_ptr<SimulationData> data;
+  std::unique_ptr<Metrics> metrics;
 };
 
 class SimulationEntity
 {
 public:
   simcpp20::simulation<Time>& sim;
+  SimulationContext& context;
   void preempt() noexcept {
     preempt_.trigger();
     preempt_ = sim.event<Time>();
@@ -40,7 +91,7 @@ public:
     abort_.trigger();
   }
 protected:
-  SimulationEntity(simcpp20::simulation<Time>& sim, config& conf) : sim(sim), conf(conf), preempt_(sim.event<Time>()), abort_(sim.event<Time>()) {}
+  SimulationEntity(simcpp20::simulation<Time>& sim, SimulationContext& context) : sim(sim), context(context), conf(context.conf), preempt_(sim.event<Time>()), abort_(sim.event<Time>()) {}
   config& conf;
   simcpp20::event<Time> preempt_, abort_;
 };
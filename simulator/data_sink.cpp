@@ -0,0 +1,74 @@
+#include "data_sink.hpp"
+#include "emergency.hpp"
+#include "ambulance.hpp"
+#include "hospital.hpp"
+#include "instance.hpp"
+#include <filesystem>
+#include <fstream>
+
+const char* DataSink::code_table(Entity entity) {
+  switch (entity) {
+    case EMERGENCY: return "emergency_code";
+    case AMBULANCE: return "ambulance_code";
+    case HOSPITAL: return "hospital_code";
+  }
+  return "";
+}
+
+const std::string& DataSink::id(Entity entity, std::int32_t index) const {
+  switch (entity) {
+    // identifiers are read from the instance, which is not modified by the simulation: ended emergencies
+    // could have already been released, and the ambulances could still be being created
+    case EMERGENCY: return context.instance->emergencies[index].id;
+    case AMBULANCE: return context.instance->ambulances[index].id;
+    default: return context.hospitals[index]->id;
+  }
+}
+
+std::int32_t DataSink::code(Entity entity, std::int32_t index) {
+  auto& known = known_codes[entity];
+  if (known.size() <= std::size_t(index))
+    known.resize(index + 1, false);
+  if (!known[index]) {
+    write_code(entity, index, id(entity, index));
+    known[index] = true;
+  }
+  return index;
+}
+
+void DataSink::write_csv_field(std::ostream& os, const std::string& s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) {
+    os << s;
+    return;
+  }
+  os << '"';
+  for (auto c : s) {
+    if (c == '"')
+      os << '"';
+    os << c;
+  }
+  os << '"';
+}
+
+std::int64_t DataSink::epoch() const {
+  // an unresolved start time would make the time offsets meaningless
+  if (context.conf.start_time.is_special())
+    throw std::logic_error("The simulation start time is not resolved, the data epoch cannot be computed");
+  return (context.conf.start_time - pt::ptime(boost::gregorian::date(1970, 1, 1))).total_seconds();
+}
+
+void DataSink::write_lookup_files(const std::string& directory) const {
+  // times are offsets in seconds from this (UNIX) epoch
+  std::ofstream simulation(std::filesystem::path(directory) / "simulation.csv");
+  simulation << "epoch\n" << epoch() << "\n";
+  std::ofstream triage(std::filesystem::path(directory) / "triage_code.csv");
+  triage << "code,name\n";
+  for (int c = Emergency::RED; c <= Emergency::BLACK; c++)
+    triage << c << "," << Emergency::Code(c) << "\n";
+  std::ofstream state(std::filesystem::path(directory) / "state_code.csv");
+  state << "code,name\n";
+  for (int s = Ambulance::UNAVAILABLE; s <= Ambulance::PREEMPTED; s++)
+    state << s << "," << std::to_string(Ambulance::State(s)) << "\n";
+  if (!simulation || !triage || !state)
+    throw std::logic_error("Could not write the lookup tables in " + directory);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "data.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+
+// A row of the simulation data: entities are referred by their index in the
+// simulation context and times are in seconds from the start of the simulation.
+struct DataRecord {
+  enum Kind : std::uint8_t {
+    RESCUE,
+    AMBULANCE_EVENT,
+    AMBULANCE_STATE
+  };
+  Kind kind;
+  // the ambulance state, the emergency triage for rescues
+  std::uint8_t state;
+  // indices of the entities in the context, -1 if missing
+  std::int32_t ambulance, emergency, hospital;
+  // rescue: call, start, at emergency and at hospital times, otherwise only the event time
+  Time times[4];
+};
+
+// Destination of the simulation data, the records are written by the writer
+// thread of SimulationData in batches, each one closed by commit. In compact
+// mode times are stored as integer seconds from the start of the simulation,
+// and identifiers, states and triage codes as integer codes described by
+// lookup tables (the code of an entity is its index, its identifier is
+// written in the lookup table when the code is first used).
+class DataSink {
+public:
+  DataSink(const SimulationContext& context, bool compact) : context(context), compact(compact) {}
+  virtual ~DataSink() = default;
+  virtual void write(const DataRecord& r) = 0;
+  virtual void commit() = 0;
+protected:
+  enum Entity {
+    EMERGENCY,
+    AMBULANCE,
+    HOSPITAL
+  };
+  static const char* code_table(Entity entity);
+  const std::string& id(Entity entity, std::int32_t index) const;
+  // returns the code of the entity, after adding it to the lookup table if needed
+  std::int32_t code(Entity entity, std::int32_t index);
+  virtual void write_code(Entity entity, std::int32_t code, const std::string& id) = 0;
+  // seconds from the UNIX epoch of the start of the simulation
+  std::int64_t epoch() const;
+  // writes the field, quoted if needed
+  static void write_csv_field(std::ostream& os, const std::string& s);
+  // writes the simulation epoch and the triage and state lookup tables as CSV files in the directory
+  void write_lookup_files(const std::string& directory) const;
+  const SimulationContext& context;
+  bool compact;
+  std::vector<bool> known_codes[HOSPITAL + 1];
+};
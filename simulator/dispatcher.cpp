@@ -2,6 +2,7 @@
 #include "dispatcher.hpp"
 #include "routing.hpp"
 #include <iostream>
+#include <cmath>
 #include "range/v3/view/map.hpp"
 #include "range/v3/view/filter.hpp"
 #include "range/v3/view/remove.hpp"
@@ -10,10 +11,14 @@
 #include "range/v3/view/transform.hpp"
 #include "range/v3/range/conversion.hpp"
 #include "range/v3/action/sort.hpp"
-#include "range/v3/numeric/accumulate.hpp"
+#include "range/v3/action/remove_if.hpp"
 
 using namespace ranges;
 
+// minimum half-width of the area covered by a moving ambulance in the spatial index
+// (routes start and end at the points snapped to the road network)
+const units::length::kilometer_t ROUTE_MARGIN = units::length::kilometer_t(2.0);
+
 // TODO: add a scheduled cleanup method that regularly (every 12/24h?) removes
 //       those emergencies that have not been served for that long
 
@@ -29,10 +34,14 @@ simcpp20::event<Time> Dispatcher::cleanup() {
         auto e = *it;
         if (now - e->occurring_time > CLEANUP_INTERVAL) {
           spdlog::warn("[{}] Cleaning up emergency {}, waiting too long {}", std::to_string(conf.start_time, now), *e, units::time::to_string(units::time::hour_t(units::time::second_t(now - e->occurring_time))));
+          waiting_places[e->triage].remove(e);
+          statistics_.emergency_not_waiting(e->triage);
+          statistics_.dropped++;
           it = el_list.second.erase(it);
+          release(e);
         }
-        else
-          ++it;
+        else // the following emergencies are more recent
+          break;
       }
     }
   } while (sim.now() < limit);
@@ -40,28 +49,12 @@ simcpp20::event<Time> Dispatcher::cleanup() {
 
 simcpp20::event<Time> Dispatcher::preempted_emergency(std::shared_ptr<Emergency> e) {
   co_await sim.timeout(0);
-  serving_emergencies[e->triage].remove(e);
-  waiting_emergencies[e->triage].push_back(e);
+  stop_serving(e);
+  enqueue_emergency(e);
+  statistics_.requeued++;
 #ifdef LOGGING
   spdlog::info("[{}] Emergency {} back to dispatcher", std::to_string(conf.start_time, sim.now()), *e);
-  size_t waiting = accumulate(waiting_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0)),
-  serving = accumulate(serving_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0));
-  Time now = sim.now();
-  auto max_waiting_time_red = units::time::second_t(accumulate(waiting_emergencies[Emergency::RED] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_yellow = units::time::second_t(accumulate(waiting_emergencies[Emergency::YELLOW] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_green = units::time::second_t(accumulate(waiting_emergencies[Emergency::GREEN] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_white = units::time::second_t(accumulate(waiting_emergencies[Emergency::WHITE] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  spdlog::info("[{}] Dispatcher (requeued {}) currently serving {} emergencies (R: {}, Y: {}, G: {}, W: {}), waiting {} emergencies (R: {}/{}, Y: {}/{}, G: {}/{}, W: {}/{})", std::to_string(conf.start_time, sim.now()), *e,
-               serving,
-               serving_emergencies[Emergency::RED].size(),
-               serving_emergencies[Emergency::YELLOW].size(),
-               serving_emergencies[Emergency::GREEN].size(),
-               serving_emergencies[Emergency::WHITE].size(),
-               waiting,
-               waiting_emergencies[Emergency::RED].size(), units::time::to_string(max_waiting_time_red),
-               waiting_emergencies[Emergency::YELLOW].size(), units::time::to_string(max_waiting_time_yellow),
-               waiting_emergencies[Emergency::GREEN].size(), units::time::to_string(max_waiting_time_green),
-               waiting_emergencies[Emergency::WHITE].size(), units::time::to_string(max_waiting_time_white));
+  log_status(fmt::format("requeued {}", *e));
 #endif
 }
 
@@ -93,12 +86,17 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
       break;
   }
   co_await sim.timeout(0); // just to be sure that is done when everything else at the same timepoint has been executed
+  // the distances of the candidate ambulances are computed together with those of the other emergencies dispatched at the same time
+  auto bases = candidate_bases(e);
+  if (!bases.empty())
+    co_await routing_batch_.request(bases, e->place);
+  statistics_.received++;
   bool served = false;
   // TODO: same management of the RED for the critical YELLOW, to be identified
   if (e->triage == Emergency::RED) {
     std::shared_ptr<Ambulance> a, mv;
-    auto ambulances = get_ambulances(e, Ambulance::ALS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
-    auto medical_vehicles = get_ambulances(e, Ambulance::MV, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+    auto ambulances = get_ambulances(e, Ambulance::ALS, context.distance_threshold, context.time_threshold);
+    auto medical_vehicles = get_ambulances(e, Ambulance::MV, context.distance_threshold, context.time_threshold);
     if (medical_vehicles.size() > 0 && ambulances.size() > 0) {
       // perfect situation, send both
       auto a = ambulances.front().first;
@@ -125,7 +123,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
       served = true;
     }
     else if (ambulances.size() == 0) {
-      ambulances = get_ambulances(e, Ambulance::BLS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+      ambulances = get_ambulances(e, Ambulance::BLS, context.distance_threshold, context.time_threshold);
       if (medical_vehicles.size() > 0 && ambulances.size() > 0) {
         // a MV but no ALS, send a BLS
         auto a = ambulances.front().first;
@@ -156,7 +154,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
   }
   else if (e->triage == Emergency::YELLOW) {
     std::shared_ptr<Ambulance> a;
-    auto ambulances = get_ambulances(e, Ambulance::ALS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+    auto ambulances = get_ambulances(e, Ambulance::ALS, context.distance_threshold, context.time_threshold);
     if (ambulances.size() > 0) {
       auto a = ambulances.front().first;
       if (!a->waiting()) {
@@ -167,7 +165,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
       served = true;
     }
     if (!served) {
-      auto ambulances = get_ambulances(e, Ambulance::BLS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+      auto ambulances = get_ambulances(e, Ambulance::BLS, context.distance_threshold, context.time_threshold);
       if (ambulances.size() > 0) {
       auto a = ambulances.front().first;
         if (!a->waiting()) {
@@ -181,7 +179,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
   }
   else if (e->triage == Emergency::GREEN) {
     std::shared_ptr<Ambulance> a;
-    auto ambulances = get_ambulances(e, Ambulance::BLS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+    auto ambulances = get_ambulances(e, Ambulance::BLS, context.distance_threshold, context.time_threshold);
     if (ambulances.size() > 0) {
       auto a = ambulances.front().first;
       if (!a->waiting()) {
@@ -191,7 +189,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
       a->assign(e, ambulances.front().second);
       served = true;
     } else {
-      ambulances = get_ambulances(e, Ambulance::ALS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+      ambulances = get_ambulances(e, Ambulance::ALS, context.distance_threshold, context.time_threshold);
       if (ambulances.size() > 0) {
         auto a = ambulances.front().first;
         if (!a->waiting()) {
@@ -204,7 +202,7 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
     }
   } else if (e->triage == Emergency::WHITE) {
     std::shared_ptr<Ambulance> a;
-    auto ambulances = get_ambulances(e, Ambulance::BLS, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+    auto ambulances = get_ambulances(e, Ambulance::BLS, context.distance_threshold, context.time_threshold);
     if (ambulances.size() > 0) {
       auto a = ambulances.front().first;
       if (!a->waiting()) {
@@ -215,39 +213,160 @@ simcpp20::event<Time> Dispatcher::new_emergency(std::shared_ptr<Emergency> e) {
       served = true;
     }
   }
+  count_position_decision();
   if (served)
-    serving_emergencies[e->triage].push_back(e);
+    start_serving(e);
   else
-    waiting_emergencies[e->triage].push_back(e);
+    enqueue_emergency(e);
 #ifdef LOGGING
-  size_t waiting = accumulate(waiting_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0)),
-  serving = accumulate(serving_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0));
-  Time now = sim.now();
-  auto max_waiting_time_red = units::time::second_t(accumulate(waiting_emergencies[Emergency::RED] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_yellow = units::time::second_t(accumulate(waiting_emergencies[Emergency::YELLOW] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_green = units::time::second_t(accumulate(waiting_emergencies[Emergency::GREEN] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  auto max_waiting_time_white = units::time::second_t(accumulate(waiting_emergencies[Emergency::WHITE] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-  
-  spdlog::info("[{}] Dispatcher (emergency {} {}) currently serving {} emergencies (R: {}, Y: {}, G: {}, W: {}), waiting {} emergencies (R: {}/{}, Y: {}/{}, G: {}/{}, W: {}/{})", std::to_string(conf.start_time, sim.now()), (served ? "served" : "waiting"), *e,
-               serving,
-               serving_emergencies[Emergency::RED].size(),
-               serving_emergencies[Emergency::YELLOW].size(),
-               serving_emergencies[Emergency::GREEN].size(),
-               serving_emergencies[Emergency::WHITE].size(),
-               waiting,
-               waiting_emergencies[Emergency::RED].size(), units::time::to_string(max_waiting_time_red),
-               waiting_emergencies[Emergency::YELLOW].size(), units::time::to_string(max_waiting_time_yellow),
-               waiting_emergencies[Emergency::GREEN].size(), units::time::to_string(max_waiting_time_green),
-               waiting_emergencies[Emergency::WHITE].size(), units::time::to_string(max_waiting_time_white));
+  log_status(fmt::format("emergency {} {}", (served ? "served" : "waiting"), *e));
 #endif
 }
 
+std::vector<Coordinate> Dispatcher::candidate_bases(std::shared_ptr<Emergency> e) {
+  // only the types selected first by the policy, the fallback ones (e.g., a BLS when no ALS is available
+  // for a RED) are rarely needed and are routed on demand
+  std::vector<Ambulance::Type> types;
+  switch (e->triage) {
+    case Emergency::RED:
+      types = { Ambulance::ALS, Ambulance::MV };
+      break;
+    case Emergency::YELLOW:
+      types = { Ambulance::ALS };
+      break;
+    case Emergency::GREEN:
+    case Emergency::WHITE:
+      types = { Ambulance::BLS };
+      break;
+    default:
+      break;
+  }
+  std::vector<Coordinate> bases;
+  std::vector<std::uint8_t> selected, reference_selected;
+  for (auto t : types) {
+    auto compatible_ambulances = filter_candidates(e, t, context.distance_threshold, false, selected, reference_selected);
+    if (!pruning()) {
+      for (const auto& a : compatible_ambulances)
+        bases.push_back(a->base);
+      continue;
+    }
+    // only the first candidates of each type are requested in advance
+    auto ranked = bounded_candidates(e, compatible_ambulances, context.time_threshold);
+    for (size_t i = 0; i < std::min(ranked.size(), context.routing_candidates); i++)
+      bases.push_back(ranked[i].first->base);
+  }
+  return bases;
+}
+
+std::vector<std::shared_ptr<Ambulance>> Dispatcher::filter_candidates(std::shared_ptr<Emergency> e, Ambulance::Type t, units::length::kilometer_t d_threshold, bool compare, std::vector<std::uint8_t>& selected, std::vector<std::uint8_t>& reference_selected) {
+  std::vector<std::shared_ptr<Ambulance>> candidates, compatible_ambulances;
+  CoordinateBatch positions, reference_positions;
+  available_ambulances[t].query(e->place, d_threshold, [this, e, compare, &candidates, &positions, &reference_positions](const auto& a) {
+    if (a->waiting() || a->preemptable(e)) {
+      candidates.push_back(a);
+      auto position = a->current_position();
+      positions.push_back(position);
+      if (compare) {
+        auto reference_position = a->reference_position();
+        reference_positions.push_back(reference_position);
+        if (a->moving)
+          statistics_.position_error(Routing::haversine(position, reference_position));
+      }
+    }
+  });
+  std::vector<std::uint8_t> close, reference_close;
+  positions.within(e->place, d_threshold, close);
+  if (compare)
+    reference_positions.within(e->place, d_threshold, reference_close);
+  selected.clear();
+  reference_selected.clear();
+  for (size_t i = 0; i < candidates.size(); i++)
+    if (close[i] || (compare && reference_close[i])) {
+      compatible_ambulances.push_back(candidates[i]);
+      selected.push_back(close[i]);
+      if (compare)
+        reference_selected.push_back(reference_close[i]);
+    }
+  return compatible_ambulances;
+}
+
+std::vector<std::pair<std::shared_ptr<Ambulance>, units::time::minute_t>> Dispatcher::bounded_candidates(std::shared_ptr<Emergency> e, const std::vector<std::shared_ptr<Ambulance>>& ambulances, units::time::minute_t t_threshold) const {
+  // the road distance is at least the haversine one, and it cannot be traveled faster than the maximum speed: the
+  // bound is admissible only if the maximum speed is not below the fastest speed of the routing profile and the
+  // snapping of the coordinates to the road network never makes a route shorter than the haversine distance
+  CoordinateBatch bases;
+  for (const auto& a : ambulances)
+    bases.push_back(a->base);
+  std::vector<float> distances;
+  bases.distances(e->place, distances);
+  std::vector<std::pair<std::shared_ptr<Ambulance>, units::time::minute_t>> ranked;
+  for (size_t i = 0; i < ambulances.size(); i++) {
+    units::time::minute_t bound = units::length::kilometer_t(distances[i]) / context.max_speed;
+    if (bound < t_threshold)
+      ranked.emplace_back(ambulances[i], bound);
+  }
+  std::sort(ranked.begin(), ranked.end(), [](const auto& p1, const auto& p2) { return int(p1.first->current_state) < int(p2.first->current_state) || (p1.first->current_state == p2.first->current_state && p1.second < p2.second); });
+  return ranked;
+}
+
 std::vector<std::pair<std::shared_ptr<Ambulance>, Routing::Segment>> Dispatcher::get_ambulances(std::shared_ptr<Emergency> e, Ambulance::Type t, units::length::kilometer_t d_threshold, units::time::minute_t t_threshold) {
-  auto compatible_ambulances = available_ambulances | views::filter([e, d_threshold](auto a) { return (a->waiting() || a->preemptable(e)) && Routing::haversine(e->place, a->current_position()) < d_threshold; }) | views::filter([t](auto a) { return a->type == t; }) | to<std::vector>();
+  bool compare = conf.position_reference.has_value();
+  // with a reference model, the routes are computed for the ambulances close under either model
+  std::vector<std::uint8_t> selected, reference_selected;
+  auto compatible_ambulances = filter_candidates(e, t, d_threshold, compare, selected, reference_selected);
   if (compatible_ambulances.size() == 0)
     return {};
-  std::vector<Routing::Segment> result = routing.compute_distances(compatible_ambulances | views::transform([](auto a) { return a->base; }) | to<std::list>, e->place);
-  return views::zip(compatible_ambulances, result) | views::filter([t_threshold](const auto& p) { return p.second.duration < t_threshold; }) | to<std::vector> | actions::sort([](const auto& p1, const auto& p2) { return int(p1.first->current_state) < int(p2.first->current_state) || (p1.first->current_state == p2.first->current_state && p1.second.duration < p2.second.duration); });
+  statistics_.candidates += compatible_ambulances.size();
+  auto rank_segments = [](const auto& p1, const auto& p2) { return int(p1.first->current_state) < int(p2.first->current_state) || (p1.first->current_state == p2.first->current_state && p1.second.duration < p2.second.duration); };
+  if (!compare && pruning()) {
+    // best first: the candidates are routed k at a time, in order of their lower bound, until
+    // none of the remaining ones can beat the best travel time found so far
+    auto ranked = bounded_candidates(e, compatible_ambulances, t_threshold);
+    std::vector<std::pair<std::shared_ptr<Ambulance>, Routing::Segment>> ambulances;
+    size_t next = 0;
+    while (next < ranked.size()) {
+      if (!ambulances.empty()) {
+        const auto& best = ambulances.front();
+        const auto& candidate = ranked[next];
+        // candidates are ranked by state, the following ones cannot be better than the best
+        if (int(best.first->current_state) < int(candidate.first->current_state) || best.second.duration <= candidate.second)
+          break;
+      }
+      size_t last = std::min(ranked.size(), next + context.routing_candidates);
+      std::list<Coordinate> bases;
+      for (size_t i = next; i < last; i++)
+        bases.push_back(ranked[i].first->base);
+      std::vector<Routing::Segment> result = routing_batch_.compute_distances(bases, e->place);
+      if (result.size() != last - next)
+        return {};
+      statistics_.routed_candidates += result.size();
+      for (size_t i = next; i < last; i++)
+        if (result[i - next].duration < t_threshold)
+          ambulances.emplace_back(ranked[i].first, result[i - next]);
+      std::sort(ambulances.begin(), ambulances.end(), rank_segments);
+      next = last;
+    }
+    return ambulances;
+  }
+  statistics_.routed_candidates += compatible_ambulances.size();
+  std::vector<Routing::Segment> result = routing_batch_.compute_distances(compatible_ambulances | views::transform([](auto a) { return a->base; }) | to<std::list>, e->place);
+  if (result.size() != compatible_ambulances.size())
+    return {};
+  auto rank = [t_threshold, rank_segments, &compatible_ambulances, &result](const std::vector<std::uint8_t>& selected) {
+    std::vector<std::pair<std::shared_ptr<Ambulance>, Routing::Segment>> ambulances;
+    for (size_t i = 0; i < compatible_ambulances.size(); i++)
+      if (selected[i] && result[i].duration < t_threshold)
+        ambulances.emplace_back(compatible_ambulances[i], result[i]);
+    return std::move(ambulances) | actions::sort(rank_segments);
+  };
+  auto ambulances = rank(selected);
+  if (compare) {
+    auto reference_ambulances = rank(reference_selected);
+    auto first = [](const auto& ambulances) { return ambulances.empty() ? nullptr : ambulances.front().first; };
+    if (first(ambulances) != first(reference_ambulances))
+      position_decision_differs = true;
+  }
+  return ambulances;
 }
 
 simcpp20::event<Time> Dispatcher::assignable_ambulance(std::shared_ptr<Ambulance> a) {
@@ -258,15 +377,42 @@ simcpp20::event<Time> Dispatcher::assignable_ambulance(std::shared_ptr<Ambulance
   spdlog::debug("[{}] Dispatcher ambulance {} available for assignment", std::to_string(conf.start_time, sim.now()), *a);
 #endif
   if (a->type != Ambulance::MV) {
-    auto compatible_emergencies = views::concat(waiting_emergencies[Emergency::RED], waiting_emergencies[Emergency::YELLOW]) | views::filter([a](const auto& e) { return Routing::haversine(e->place, a->current_position()) < DISTANCE_THRESHOLD; }) | to<std::vector>;
+    auto position = a->current_position();
+    std::vector<std::shared_ptr<Emergency>> candidates, compatible_emergencies;
+    CoordinateBatch places;
+    std::vector<std::uint8_t> close;
+    auto collect = [&candidates, &places](const auto& e) {
+      candidates.push_back(e);
+      places.push_back(e->place);
+    };
+    auto filter = [this, position, &candidates, &places, &close, &compatible_emergencies]() {
+      places.within(position, context.distance_threshold, close);
+      for (size_t i = 0; i < candidates.size(); i++)
+        if (close[i])
+          compatible_emergencies.push_back(candidates[i]);
+    };
+    waiting_places[Emergency::RED].query(position, context.distance_threshold, collect);
+    waiting_places[Emergency::YELLOW].query(position, context.distance_threshold, collect);
+    filter();
     if (compatible_emergencies.size() == 0) {
-      compatible_emergencies = views::concat(waiting_emergencies[Emergency::GREEN], waiting_emergencies[Emergency::WHITE]) | views::filter([a](const auto& e) { return Routing::haversine(e->place, a->current_position()) < DISTANCE_THRESHOLD; }) | to<std::vector>;
+      candidates.clear();
+      places.clear();
+      waiting_places[Emergency::GREEN].query(position, context.distance_threshold, collect);
+      waiting_places[Emergency::WHITE].query(position, context.distance_threshold, collect);
+      filter();
       if (compatible_emergencies.size() == 0)
         co_return;
     }
-    auto now = sim.now();
-    auto t_threshold = TIME_THRESHOLD;
-    std::vector<Routing::Segment> routes = routing.compute_distances({ a->current_position() }, compatible_emergencies | views::transform([](auto e) { return e->place; }) | to<std::list>);
+    // the distances are computed together with those of the other dispatch decisions taken at the same time
+    co_await routing_batch_.request({ position }, compatible_emergencies | views::transform([](auto e) { return e->place; }) | to<std::vector>);
+    // meanwhile, the ambulance or some of the emergencies could have been taken by another decision
+    if (a->assigned())
+      co_return;
+    compatible_emergencies = std::move(compatible_emergencies) | actions::remove_if([this](const auto& e) { return !waiting_emergencies[e->triage].contains(e); });
+    if (compatible_emergencies.size() == 0)
+      co_return;
+    auto t_threshold = context.time_threshold;
+    std::vector<Routing::Segment> routes = routing_batch_.compute_distances(position, compatible_emergencies | views::transform([](auto e) { return e->place; }) | to<std::list>);
     
     auto result = views::zip(compatible_emergencies, routes) | views::filter([t_threshold](const auto& p) { return p.second.duration < t_threshold; }) | to<std::vector> | actions::sort([](const auto& p1, const auto& p2) { return int(p1.first->triage) < int(p2.first->triage) || (p1.first->triage == p2.first->triage && p1.first->occurring_time < p2.first->occurring_time) || (p1.first->triage == p2.first->triage && p1.first->occurring_time == p2.first->occurring_time &&  p1.second.duration < p2.second.duration); });
     if (result.size() == 0)
@@ -278,11 +424,12 @@ simcpp20::event<Time> Dispatcher::assignable_ambulance(std::shared_ptr<Ambulance
       assert(a->preemptable(e));
       a->preempt();
     }
-    waiting_emergencies[e->triage].remove(e);
-    serving_emergencies[e->triage].push_back(e);
+    dequeue_emergency(e);
+    start_serving(e);
     //a->assign(e, s);
     if (e->triage == Emergency::RED) {
-      auto medical_vehicles = get_ambulances(e, Ambulance::MV, DISTANCE_THRESHOLD, TIME_THRESHOLD);
+      auto medical_vehicles = get_ambulances(e, Ambulance::MV, context.distance_threshold, context.time_threshold);
+      count_position_decision();
       if (medical_vehicles.size() > 0) {
         auto mv = medical_vehicles.front().first;
         if (medical_vehicles.front().second.duration < s.duration || medical_vehicles.front().second.duration < units::time::second_t(1.1 * SERVICE_TIME_THRESHOLD)) {
@@ -298,42 +445,91 @@ simcpp20::event<Time> Dispatcher::assignable_ambulance(std::shared_ptr<Ambulance
     } else
       a->assign(e, s);
 #ifdef LOGGING
-    size_t waiting = accumulate(waiting_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0)),
-    serving = accumulate(serving_emergencies | views::values | views::transform([](auto& l){ return l.size(); }), size_t(0));
-    auto max_waiting_time_red = units::time::second_t(accumulate(waiting_emergencies[Emergency::RED] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-    auto max_waiting_time_yellow = units::time::second_t(accumulate(waiting_emergencies[Emergency::YELLOW] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-    auto max_waiting_time_green = units::time::second_t(accumulate(waiting_emergencies[Emergency::GREEN] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-    auto max_waiting_time_white = units::time::second_t(accumulate(waiting_emergencies[Emergency::WHITE] | views::transform([now](const auto& e) { return now - e->occurring_time; }), 0, [](Time a, Time b) { return std::max(a, b); }));
-    spdlog::info("[{}] Dispatcher (ambulance {} for {}) currently serving {} emergencies (R: {}, Y: {}, G: {}, W: {}), waiting {} emergencies (R: {}/{}, Y: {}/{}, G: {}/{}, W: {}/{})", std::to_string(conf.start_time, sim.now()), *a, *e,
-                 serving,
-                 serving_emergencies[Emergency::RED].size(),
-                 serving_emergencies[Emergency::YELLOW].size(),
-                 serving_emergencies[Emergency::GREEN].size(),
-                 serving_emergencies[Emergency::WHITE].size(),
-                 waiting,
-                 waiting_emergencies[Emergency::RED].size(), units::time::to_string(max_waiting_time_red),
-                 waiting_emergencies[Emergency::YELLOW].size(), units::time::to_string(max_waiting_time_yellow),
-                 waiting_emergencies[Emergency::GREEN].size(), units::time::to_string(max_waiting_time_green),
-                 waiting_emergencies[Emergency::WHITE].size(), units::time::to_string(max_waiting_time_white));
+    log_status(fmt::format("ambulance {} for {}", *a, *e));
 #endif
   }
 }
 
 void Dispatcher::ambulance_available(std::shared_ptr<Ambulance> a) {
 #ifdef NDEBUG
-  assert(!std::any_of(available_ambulances.begin(), available_ambulances.end(), [a](const auto& p) { return p == a; } ));
+  assert(!available_ambulances[a->type].contains(a));
 #endif
-  available_ambulances.push_back(a);
+  index_ambulance(a);
   assignable_ambulance(a);
 }
 
+void Dispatcher::ambulance_moved(std::shared_ptr<Ambulance> a) {
+  if (available_ambulances[a->type].contains(a))
+    index_ambulance(a);
+}
+
+void Dispatcher::index_ambulance(std::shared_ptr<Ambulance> a) {
+  if (a->moving) {
+    // every point of a road of length d between two points at distance l lies within
+    // the ellipse with those foci, whose half-width is sqrt(d^2 - l^2) / 2: the straight
+    // travel is covered up to that margin, so that no route is requested to index it
+    const auto& s = a->current_segment;
+    auto straight = Routing::haversine(s.start_point, s.end_point).value(), road = s.distance.value();
+    auto detour = units::length::kilometer_t(0.5 * std::sqrt(std::max(0.0, road * road - straight * straight)));
+    available_ambulances[a->type].insert(a, s.start_point, s.end_point, std::max(ROUTE_MARGIN, detour));
+  } else
+    available_ambulances[a->type].insert(a, a->current_position_);
+}
+
+void Dispatcher::enqueue_emergency(std::shared_ptr<Emergency> e) {
+  if (waiting_emergencies[e->triage].insert(e))
+    statistics_.emergency_waiting(e->triage);
+  waiting_places[e->triage].insert(e, e->place);
+}
+
+void Dispatcher::dequeue_emergency(std::shared_ptr<Emergency> e) {
+  if (waiting_emergencies[e->triage].erase(e))
+    statistics_.emergency_not_waiting(e->triage);
+  waiting_places[e->triage].remove(e);
+}
+
+void Dispatcher::start_serving(std::shared_ptr<Emergency> e) {
+  if (serving_emergencies[e->triage].insert(e))
+    statistics_.emergency_serving(e->triage);
+}
+
+void Dispatcher::stop_serving(std::shared_ptr<Emergency> e) {
+  if (serving_emergencies[e->triage].erase(e))
+    statistics_.emergency_not_serving(e->triage);
+}
+
+void Dispatcher::count_position_decision() {
+  if (!conf.position_reference)
+    return;
+  statistics_.position_decisions++;
+  if (position_decision_differs)
+    statistics_.position_differences++;
+  position_decision_differs = false;
+}
+
+void Dispatcher::log_status(const std::string& event) const {
+  Time now = sim.now();
+  const auto& s = statistics_;
+  spdlog::info("[{}] Dispatcher ({}) currently serving {} emergencies (R: {}, Y: {}, G: {}, W: {}), waiting {} emergencies (R: {}/{}, Y: {}/{}, G: {}/{}, W: {}/{})", std::to_string(conf.start_time, now), event,
+               s.serving(),
+               s.serving(Emergency::RED),
+               s.serving(Emergency::YELLOW),
+               s.serving(Emergency::GREEN),
+               s.serving(Emergency::WHITE),
+               s.waiting(),
+               s.waiting(Emergency::RED), units::time::to_string(s.max_waiting_time(Emergency::RED, now)),
+               s.waiting(Emergency::YELLOW), units::time::to_string(s.max_waiting_time(Emergency::YELLOW, now)),
+               s.waiting(Emergency::GREEN), units::time::to_string(s.max_waiting_time(Emergency::GREEN, now)),
+               s.waiting(Emergency::WHITE), units::time::to_string(s.max_waiting_time(Emergency::WHITE, now)));
+}
+
 simcpp20::event<Time> Dispatcher::ambulance_unavailable(std::shared_ptr<Ambulance> a) {
 //  auto it = std::find_if(available_ambulances.begin(), available_ambulances.end(), [a](const auto& p) { return p == a; });
 #ifdef NDEBUG
   assert(it != available_ambulances.end());
   assert(a->current_state != Ambulance::UNAVAILABLE);
 #endif
-  available_ambulances.remove(a);
+  available_ambulances[a->type].remove(a);
   if (a->waiting()) {
     auto ev = sim.event();
     ev.trigger();
@@ -344,6 +540,9 @@ simcpp20::event<Time> Dispatcher::ambulance_unavailable(std::shared_ptr<Ambulanc
 }
 
 void Dispatcher::emergency_served(std::shared_ptr<Emergency> e) {
+  // both the ambulances of a pair report the end of a rescue with no hospital
+  if (e->current_state == Emergency::ENDED)
+    return;
 #ifdef NDEBUG
   for (const auto em_list : serving_emergencies) {
     assert(any_of(em_list, [e](const auto& p) { return p == e; }));
@@ -352,5 +551,12 @@ void Dispatcher::emergency_served(std::shared_ptr<Emergency> e) {
     assert(!any_of(em_list, [e](const auto& p) { return p == e; }));
   }
 #endif
-  serving_emergencies[e->triage].remove(e);
+  stop_serving(e);
+  statistics_.completed++;
+  release(e);
+}
+
+void Dispatcher::release(std::shared_ptr<Emergency> e) {
+  e->current_state = Emergency::ENDED;
+  context.emergencies[e->index].reset();
 }
@@ -1,23 +1,58 @@
 #pragma once
 
 #include "helpers.hpp"
+#include "spatial_index.hpp"
+#include "coordinate_batch.hpp"
+#include "dispatcher_statistics.hpp"
+#include "routing_batch.hpp"
 
 class Dispatcher : public SimulationEntity
 {
   typedef simcpp20::value_event<std::shared_ptr<Ambulance>, Time> AmbulanceAssignment;
 public:
-  Dispatcher(simcpp20::simulation<Time>& sim, config& conf, Routing& routing) : SimulationEntity(sim, conf), routing(routing) { cleanup(); }
+  Dispatcher(simcpp20::simulation<Time>& sim, SimulationContext& context, Routing& routing) : SimulationEntity(sim, context), statistics_(waiting_emergencies), routing(routing), routing_batch_(sim, routing), position_decision_differs(false) { cleanup(); }
   simcpp20::event<Time> new_emergency(std::shared_ptr<Emergency> e);
   simcpp20::event<Time> preempted_emergency(std::shared_ptr<Emergency> e);
   simcpp20::event<Time> assignable_ambulance(std::shared_ptr<Ambulance> a);
   void ambulance_available(std::shared_ptr<Ambulance> a);
   void emergency_served(std::shared_ptr<Emergency> e);
   simcpp20::event<Time> ambulance_unavailable(std::shared_ptr<Ambulance> a);
+  // to be called whenever an ambulance starts or ends a travel
+  void ambulance_moved(std::shared_ptr<Ambulance> a);
+  inline const DispatcherStatistics& statistics() const { return statistics_; }
+  inline const RoutingBatch& routing_batch() const { return routing_batch_; }
 protected:
+  void index_ambulance(std::shared_ptr<Ambulance> a);
+  void enqueue_emergency(std::shared_ptr<Emergency> e);
+  void dequeue_emergency(std::shared_ptr<Emergency> e);
+  void start_serving(std::shared_ptr<Emergency> e);
+  void stop_serving(std::shared_ptr<Emergency> e);
+  // the emergency has ended, it is removed from the registry (its memory is released with the last reference)
+  void release(std::shared_ptr<Emergency> e);
+  void log_status(const std::string& event) const;
+  // a dispatch decision (all the selections of a new emergency, or of the medical vehicle of a
+  // RED one picked up by a free ambulance) differs if any of its selections differs with the reference model
+  void count_position_decision();
   simcpp20::event<Time> cleanup();
+  // bases of the ambulances that could be sent to the emergency, of the types its triage code is served with first
+  std::vector<Coordinate> candidate_bases(std::shared_ptr<Emergency> e);
+  // ambulances of the type that could be sent to the emergency (waiting or preemptable) within the distance
+  // threshold; when comparing the position models, also those within it only under the reference model, the
+  // masks tell under which model each ambulance is within the threshold
+  std::vector<std::shared_ptr<Ambulance>> filter_candidates(std::shared_ptr<Emergency> e, Ambulance::Type t, units::length::kilometer_t d_threshold, bool compare, std::vector<std::uint8_t>& selected, std::vector<std::uint8_t>& reference_selected);
+  // candidates whose lower bound of the travel time from their base is below the threshold,
+  // ranked by state and bound (i.e., in the order of the dispatching policy)
+  std::vector<std::pair<std::shared_ptr<Ambulance>, units::time::minute_t>> bounded_candidates(std::shared_ptr<Emergency> e, const std::vector<std::shared_ptr<Ambulance>>& ambulances, units::time::minute_t t_threshold) const;
+  inline bool pruning() const { return context.max_speed > units::velocity::kilometers_per_hour_t(0.0) && context.routing_candidates > 0; }
   // The following two methods implement the dispatching policy
   std::vector<std::pair<std::shared_ptr<Ambulance>, Routing::Segment>> get_ambulances(std::shared_ptr<Emergency> e, Ambulance::Type t, units::length::kilometer_t d_threshold, units::time::minute_t t_threshold);
-  std::map<Emergency::Code, std::list<std::shared_ptr<Emergency>>> waiting_emergencies, serving_emergencies;
-  std::list<std::shared_ptr<Ambulance>> available_ambulances;
+  std::map<Emergency::Code, EmergencyQueue> waiting_emergencies, serving_emergencies;
+  // waiting emergencies of each triage code, indexed by their place (kept in sync with waiting_emergencies)
+  std::map<Emergency::Code, SpatialGrid<std::shared_ptr<Emergency>>> waiting_places;
+  DispatcherStatistics statistics_;
+  // available ambulances of each type, indexed by their position (or by the area of their current travel)
+  std::map<Ambulance::Type, SpatialGrid<std::shared_ptr<Ambulance>>> available_ambulances;
   Routing& routing;
+  RoutingBatch routing_batch_;
+  bool position_decision_differs;
 };
@@ -0,0 +1,9 @@
+#include "dispatcher_statistics.hpp"
+
+units::time::second_t DispatcherStatistics::max_waiting_time(Emergency::Code c, Time now) const
+{
+  auto it = waiting_emergencies.find(c);
+  if (it == waiting_emergencies.end() || it->second.empty())
+    return units::time::second_t(0.0);
+  return units::time::second_t(now - it->second.front()->occurring_time);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "emergency_queue.hpp"
+#include <map>
+#include <array>
+#include <algorithm>
+
+// Counters of the emergencies handled by the dispatcher, updated as the
+// emergencies move between the waiting and the serving queues, so that
+// reading them never requires a scan. The longest waiting time is read from
+// the head of the (time-ordered) waiting queues.
+class DispatcherStatistics {
+public:
+  DispatcherStatistics(const std::map<Emergency::Code, EmergencyQueue>& waiting_emergencies) : received(0), requeued(0), dropped(0), completed(0), position_decisions(0), position_differences(0), position_errors(0), max_position_error(0.0), total_position_error(0.0), candidates(0), routed_candidates(0), waiting_emergencies(waiting_emergencies), waiting_{}, serving_{} {}
+
+  inline void emergency_waiting(Emergency::Code c) { waiting_[c]++; }
+  inline void emergency_not_waiting(Emergency::Code c) { waiting_[c]--; }
+  inline void emergency_serving(Emergency::Code c) { serving_[c]++; }
+  inline void emergency_not_serving(Emergency::Code c) { serving_[c]--; }
+
+  inline std::size_t waiting(Emergency::Code c) const { return waiting_[c]; }
+  inline std::size_t serving(Emergency::Code c) const { return serving_[c]; }
+  inline std::size_t waiting() const { return total(waiting_); }
+  inline std::size_t serving() const { return total(serving_); }
+  units::time::second_t max_waiting_time(Emergency::Code c, Time now) const;
+
+  // cumulative counts: new emergencies, emergencies back from a preemption, emergencies
+  // removed by the cleanup procedure and emergencies completely served
+  std::size_t received, requeued, dropped, completed;
+  // dispatch decisions evaluated with the reference position model, and those that selected a different ambulance
+  std::size_t position_decisions, position_differences;
+  // distances between the positions of the moving candidates under the two models
+  inline void position_error(units::length::kilometer_t error)
+  {
+    position_errors++;
+    max_position_error = std::max(max_position_error, error);
+    total_position_error += error;
+  }
+  inline units::length::kilometer_t mean_position_error() const { return position_errors > 0 ? total_position_error / double(position_errors) : units::length::kilometer_t(0.0); }
+  std::size_t position_errors;
+  units::length::kilometer_t max_position_error, total_position_error;
+  // ambulances compatible with the emergencies and those whose travel time has been computed
+  std::size_t candidates, routed_candidates;
+protected:
+  static inline std::size_t total(const std::array<std::size_t, Emergency::BLACK + 1>& counts)
+  {
+    std::size_t sum = 0;
+    for (auto c : counts)
+      sum += c;
+    return sum;
+  }
+  const std::map<Emergency::Code, EmergencyQueue>& waiting_emergencies;
+  std::array<std::size_t, Emergency::BLACK + 1> waiting_, serving_;
+};
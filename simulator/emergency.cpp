@@ -3,7 +3,9 @@
 #include "routing.hpp"
 #include "helpers.hpp"
 #include "dispatcher.hpp"
+#include "instance.hpp"
 #include <iostream>
+#include <algorithm>
 
 std::istream &operator>>(std::istream &is, Emergency::Code &code)
 {
@@ -24,25 +26,6 @@ std::istream &operator>>(std::istream &is, Emergency::Code &code)
   return is;
 }
 
-std::istream &operator>>(std::istream &is, Emergency &e)
-{
-  std::string tmp, date, time;
-  is >> e.id >> e.municipality >> e.triage >> e.place >> tmp >> date >> time;
-  tmp = date + " " + time;
-  boost::trim(tmp);
-  e.timestamp = pt::time_from_string(tmp);
-  std::getline(is, tmp);
-  boost::trim(tmp);
-  if (tmp != "") {
-    e.needs_hospital = true;
-    std::istringstream read_is(tmp);
-    read_is >> e.needed_hospital >> e.actual_hospital;
-  } else {
-    e.needs_hospital = false;
-  }
-  return is;
-}
-
 std::ostream& operator<<(std::ostream &os, const Emergency::Code& c) {
   switch (c) {
     case Emergency::Code::RED:
@@ -67,46 +50,57 @@ std::ostream& operator<<(std::ostream &os, const Emergency::Code& c) {
 simcpp20::event<Time> Emergency::generate()
 {
   current_state = SCHEDULED;
-  // put the emergency in the event queue at the right time
-  occurring_time = (timestamp - conf.start_time).total_seconds() - sim.now();
+  occurring_time = sim.now();
   start_serving_time = reaching_time = at_hospital_time = std::numeric_limits<Time>::max();  
-  co_await sim.timeout(occurring_time);
 #ifdef LOGGING
   spdlog::info("[{}] Emergency {} happens at {}", std::to_string(conf.start_time, sim.now()), *this, std::to_string(place));
 #endif
-  co_await dispatcher.new_emergency(emergencies[index]);
+  co_await dispatcher.new_emergency(context.emergencies[index]);
+}
+
+// Tie rule: events at the same time are processed in the order they were scheduled. The
+// first arrival is scheduled at time 0, before Ambulance::source registers the shifts, but
+// each following arrival is scheduled only when the previous one occurs, so it is processed
+// after the ambulance events of the same second that were scheduled before (whereas one
+// timeout per emergency, all scheduled at time 0, came first).
+simcpp20::event<Time> Emergency::arrival_process(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher, std::vector<Arrival> arrivals)
+{
+  for (const auto& a : arrivals)
+  {
+    const auto& r = instance.emergencies[a.record];
+    Time t = (r.timestamp - context.conf.start_time).total_seconds();
+    if (t > sim.now())
+      co_await sim.timeout(t - sim.now());
+    auto e = std::allocate_shared<Emergency>(std::pmr::polymorphic_allocator<Emergency>(&context.emergency_pool), sim, context, dispatcher, a.treatment_duration);
+    e->id = r.id;
+    e->municipality = r.municipality;
+    e->triage = r.triage;
+    e->place = r.place;
+    e->timestamp = r.timestamp;
+    e->needs_hospital = r.needs_hospital;
+    e->needed_hospital = r.needed_hospital;
+    e->actual_hospital = r.actual_hospital;
+    e->index = a.record;
+    context.emergencies[a.record] = e;
+    e->generate();
+  }
 }
 
-void Emergency::source(std::istream &is, simcpp20::simulation<Time> &sim, config &conf, Dispatcher& dispatcher)
+void Emergency::resolve_horizon(const Instance& instance, config& conf)
 {
   pt::ptime min_time, max_time;
-  while (!is.eof())
+  for (const auto& r : instance.emergencies)
   {
-    auto e = std::make_shared<Emergency>(sim, conf, dispatcher);
-    try
-    {
-      is >> *e;
-    }
-    catch (std::exception &e)
+    if ((conf.start_time.is_special() || r.timestamp >= conf.start_time) && (conf.end_time.is_special() || r.timestamp <= conf.end_time))
     {
-      spdlog::error("An exception occurred while reading emergencies file {}", e.what());
-      continue;
+      if (min_time.is_not_a_date_time() || min_time > r.timestamp)
+        min_time = r.timestamp;
+      if (max_time.is_not_a_date_time() || max_time < r.timestamp)
+        max_time = r.timestamp;
     }
-
-    // avoid generating emergencies beyond the times (if provided)
-    if ((conf.start_time.is_special() || e->timestamp >= conf.start_time) && (conf.end_time.is_special() || e->timestamp <= conf.end_time))
-    {
-      if (min_time.is_not_a_date_time() || min_time > e->timestamp)
-        min_time = e->timestamp;
-      if (max_time.is_not_a_date_time() || max_time < e->timestamp)
-        max_time = e->timestamp;
-      emergencies.push_back(e);
-      e->index = emergencies.size() - 1;
-      e->generate();
-    } 
   }
-  spdlog::info(min_time);
-  spdlog::info(max_time);
+  if (min_time.is_not_a_date_time() && (conf.start_time.is_not_a_date_time() || conf.end_time.is_not_a_date_time()))
+    throw std::logic_error("No emergency to simulate, the simulation horizon cannot be determined");
   // update start and end time if not provided or too loose
   if (conf.start_time.is_not_a_date_time())
     conf.start_time = pt::ptime(min_time.date());
@@ -116,4 +110,23 @@ void Emergency::source(std::istream &is, simcpp20::simulation<Time> &sim, config
   spdlog::info("Simulation horizon {} - {}", to_simple_string(conf.start_time), to_simple_string(conf.end_time));
 }
 
-std::vector<std::shared_ptr<Emergency>> Emergency::emergencies;
+void Emergency::source(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher)
+{
+  auto& conf = context.conf;
+  if (conf.start_time.is_special() || conf.end_time.is_special())
+    throw std::logic_error("The simulation horizon must be resolved before the emergencies are generated");
+  std::vector<Arrival> arrivals;
+  for (std::size_t i = 0; i < instance.emergencies.size(); i++)
+  {
+    const auto& r = instance.emergencies[i];
+    // the treatment duration is drawn anyway, so that the random draws do not depend on the simulation horizon
+    Time treatment_duration = 200 + conf.treatment_duration_dist(conf.gen);
+    // avoid generating emergencies beyond the times
+    if (r.timestamp >= conf.start_time && r.timestamp <= conf.end_time)
+      arrivals.push_back({ i, treatment_duration });
+  }
+  // the slots are filled as the emergencies occur, emergencies at the same time keep the file order
+  context.emergencies.assign(instance.emergencies.size(), nullptr);
+  std::stable_sort(arrivals.begin(), arrivals.end(), [&instance](const Arrival& a1, const Arrival& a2) { return instance.emergencies[a1.record].timestamp < instance.emergencies[a2.record].timestamp; });
+  arrival_process(instance, sim, context, dispatcher, std::move(arrivals));
+}
@@ -8,15 +8,22 @@
 #include <limits>
 
 class Dispatcher;
+class Instance;
 
 class Emergency : public SimulationEntity
 {
   friend class Dispatcher;
 public:
-  Emergency(simcpp20::simulation<Time>& sim, config& conf, Dispatcher& dispatcher) : SimulationEntity(sim, conf), current_state(UNSCHEDULED), dispatcher(dispatcher), treatment_duration(200 + conf.treatment_duration_dist(conf.gen)), start_serving_time(std::numeric_limits<Time>::max()), reaching_time(std::numeric_limits<Time>::max()), at_hospital_time(std::numeric_limits<Time>::max())
+  Emergency(simcpp20::simulation<Time>& sim, SimulationContext& context, Dispatcher& dispatcher, Time treatment_duration) : SimulationEntity(sim, context), current_state(UNSCHEDULED), dispatcher(dispatcher), treatment_duration(treatment_duration), start_serving_time(std::numeric_limits<Time>::max()), reaching_time(std::numeric_limits<Time>::max()), at_hospital_time(std::numeric_limits<Time>::max())
   {}
 protected:
   simcpp20::event<Time> generate();  
+  // an emergency of the instance, to be created at its time
+  struct Arrival {
+    std::size_t record;
+    Time treatment_duration;
+  };
+  static simcpp20::event<Time> arrival_process(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher, std::vector<Arrival> arrivals);
 public:
   enum Code
   {
@@ -53,9 +60,12 @@ public:
   
   // TODO: create state management functions (i.e., on_treatment(), etc.)
   
-  static void source(std::istream &is, simcpp20::simulation<Time> &sim, config &conf, Dispatcher& dispatcher);
-protected:
-  static std::vector<std::shared_ptr<Emergency>> emergencies;
+  // sets the start (end) time, if not provided, to the beginning (end) of the day of the first (last)
+  // emergency within the provided times; it must be called before the data sinks and the sources are built
+  static void resolve_horizon(const Instance& instance, config& conf);
+  // emergencies are created (and indexed as the instance records) by a single arrival process, each one when it occurs
+  static void source(const Instance& instance, simcpp20::simulation<Time> &sim, SimulationContext &context, Dispatcher& dispatcher);
 };
 
 std::ostream& operator<<(std::ostream &os, const Emergency::Code& c);
+std::istream& operator>>(std::istream &is, Emergency::Code& c);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "emergency.hpp"
+#include <set>
+#include <memory>
+
+// Emergencies of one triage code ordered by occurring time (ties broken by
+// index, which is unique). Insertion and removal of a given emergency take
+// logarithmic time, iteration goes from the oldest to the newest emergency.
+class EmergencyQueue {
+  struct Compare {
+    bool operator()(const std::shared_ptr<Emergency>& e1, const std::shared_ptr<Emergency>& e2) const
+    {
+      return e1->occurring_time < e2->occurring_time || (e1->occurring_time == e2->occurring_time && e1->index < e2->index);
+    }
+  };
+  typedef std::set<std::shared_ptr<Emergency>, Compare> Container;
+public:
+  typedef Container::const_iterator iterator;
+  typedef Container::const_iterator const_iterator;
+
+  inline bool insert(const std::shared_ptr<Emergency>& e) { return emergencies.insert(e).second; }
+  inline bool erase(const std::shared_ptr<Emergency>& e) { return emergencies.erase(e) > 0; }
+  inline iterator erase(iterator it) { return emergencies.erase(it); }
+  inline bool contains(const std::shared_ptr<Emergency>& e) const { return emergencies.count(e) > 0; }
+  // the oldest emergency, the queue must not be empty
+  inline const std::shared_ptr<Emergency>& front() const { return *emergencies.begin(); }
+  inline std::size_t size() const { return emergencies.size(); }
+  inline bool empty() const { return emergencies.empty(); }
+  inline iterator begin() const { return emergencies.begin(); }
+  inline iterator end() const { return emergencies.end(); }
+protected:
+  Container emergencies;
+};
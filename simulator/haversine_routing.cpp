@@ -0,0 +1,62 @@
+#include "haversine_routing.hpp"
+#include <algorithm>
+
+// maximum length (in km) of the steps of a computed route
+const double ROUTE_STEP_LENGTH = 1.0;
+
+double HaversineRouting::SpeedModel::travel_time(double road_distance) const
+{
+  double urban = std::min(road_distance, urban_range);
+  double rural = std::clamp(road_distance - urban_range, 0.0, rural_range - urban_range);
+  double highway = std::max(road_distance - rural_range, 0.0);
+  return 3600.0 * (urban / urban_speed + rural / rural_speed + highway / highway_speed);
+}
+
+bool HaversineRouting::compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances)
+{
+  durations.resize(sources.size() * destinations.size());
+  distances.resize(sources.size() * destinations.size());
+  for (size_t s = 0; s < sources.size(); s++)
+  {
+    for (size_t d = 0; d < destinations.size(); d++)
+    {
+      double road_distance = model.road_distance(sources[s], destinations[d]);
+      durations[s * destinations.size() + d] = travel_time(road_distance);
+      distances[s * destinations.size() + d] = 1000.0 * road_distance;
+    }
+  }
+  return true;
+}
+
+std::list<Routing::Segment> HaversineRouting::compute_route(const Coordinate& start_point, const Coordinate& end_point)
+{
+  std::list<Routing::Segment> route;
+  double road_distance = model.road_distance(start_point, end_point);
+  if (road_distance == 0.0)
+  {
+    route.emplace_back(make_segment(start_point, end_point, 0.0, 0.0));
+    return route;
+  }
+  // the straight line is split into steps that do not cross the road class boundaries
+  auto point_at = [&](double traveled) {
+    double f = traveled / road_distance;
+    return Coordinate{osrm::util::FloatLongitude{start_point.lon.__value + f * (end_point.lon.__value - start_point.lon.__value)}, osrm::util::FloatLatitude{start_point.lat.__value + f * (end_point.lat.__value - start_point.lat.__value)}};
+  };
+  double traveled = 0.0;
+  Coordinate current = start_point;
+  while (traveled < road_distance)
+  {
+    double next = std::min(traveled + ROUTE_STEP_LENGTH, road_distance);
+    if (traveled < model.urban_range && next > model.urban_range)
+      next = model.urban_range;
+    else if (traveled < model.rural_range && next > model.rural_range)
+      next = model.rural_range;
+    Coordinate next_point = next < road_distance ? point_at(next) : end_point;
+    auto segment = make_segment(current, next_point, travel_time(next) - travel_time(traveled), 1000.0 * (next - traveled));
+    segment.on_highway = traveled >= model.rural_range;
+    route.emplace_back(segment);
+    traveled = next;
+    current = next_point;
+  }
+  return route;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "routing.hpp"
+
+// Analytic routing backend, it requires no road network data. The road distance
+// is estimated as the haversine distance times a detour factor and it is
+// travelled at the speed of the road classes crossed: urban roads for the first
+// kilometers, then extra-urban roads and finally highways.
+class HaversineRouting : public Routing {
+public:
+  struct SpeedModel {
+    double detour_factor = 1.3;
+    // speeds are expressed in km/h
+    double urban_speed = 40.0, rural_speed = 70.0, highway_speed = 110.0;
+    // road distance (in km) up to which the urban and the extra-urban speeds apply
+    double urban_range = 5.0, rural_range = 30.0;
+    // road distance (in km) between two points
+    inline double road_distance(const Coordinate& c1, const Coordinate& c2) const { return detour_factor * Routing::haversine(c1, c2).value(); }
+    // travel time (in seconds) for the given road distance (in km)
+    double travel_time(double road_distance) const;
+  };
+  
+  HaversineRouting(const SpeedModel& model) : Routing(0), model(model) {}
+  
+  using Routing::compute_distances;
+  std::list<Segment> compute_route(const Coordinate& start_point, const Coordinate& end_point) override;
+  
+protected:
+  bool compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances) override;
+  inline double travel_time(double road_distance) const { return model.travel_time(road_distance); }
+  SpeedModel model;
+};
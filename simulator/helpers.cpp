@@ -1,81 +1,95 @@
 #include "data.hpp"
 #include "helpers.hpp"
+#include "metrics.hpp"
 
-bool colored = false;
-units::length::kilometer_t DISTANCE_THRESHOLD = units::length::kilometer_t(20.0);
-units::time::minute_t TIME_THRESHOLD(45.0);
+SimulationContext::SimulationContext(const config& conf) : conf(conf), distance_threshold(20.0), time_threshold(45.0), max_speed(130.0), routing_candidates(8), colored(false), instance(nullptr), metrics(std::make_unique<Metrics>()) {}
 
-void SimulationData::set_database(std::string db_filename) {    
-  SimulationData::db = std::make_unique<SQLite::Database>(db_filename, SQLite::OPEN_READWRITE|SQLite::OPEN_CREATE);
-  SQLite::Transaction transaction(*SimulationData::db);
-  db->exec("DROP TABLE IF EXISTS rescue");
-  db->exec("CREATE TABLE IF NOT EXISTS rescue (emergency VARCHAR(255) NOT NULL, ambulance VARCHAR(255) NOT NULL, hospital VARCHAR(32), triage VARCHAR(10) NOT NULL, call DATETIME NOT NULL, start DATETIME NOT NULL, at_emergency DATETIME NOT NULL, at_hospital DATETIME, PRIMARY KEY (emergency, ambulance))");
-  db->exec("DROP TABLE IF EXISTS ambulance_event");
-  db->exec("CREATE TABLE IF NOT EXISTS ambulance_event (ambulance VARCHAR(255) NOT NULL, emergency VARCHAR(255), state VARCHAR(255) NOT NULL, time DATETIME NOT NULL)");
-  transaction.commit();
+SimulationContext::~SimulationContext() = default;
+
+SimulationData::SimulationData(std::unique_ptr<DataSink> sink, const Options& options) : options(options), sink(std::move(sink)), batch_rows(0), queue(options.queue_size), closing(false) {
+  if (this->sink)
+    writer = std::thread(&SimulationData::write_records, this);
 }
 
-void SimulationData::log_rescue(const Emergency& e, const Ambulance& a, const pt::ptime& start_time) {
-  try {
-    if (!SimulationData::db)
-      return;
-    SQLite::Statement query(*SimulationData::db, "INSERT INTO rescue VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
-    SQLite::Transaction transaction(* SimulationData::db);
-    query.bind(1, e.id);
-    query.bind(2, a.id);
-    if (e.needs_hospital)
-      query.bind(3, e.assigned_hospital->id);
-    else
-      query.bind(3, nullptr);
-    query.bind(4, std::to_string(e.triage));
-    query.bind(5, std::to_string(start_time, e.occurring_time));
-    query.bind(6, std::to_string(start_time, e.start_serving_time));
-    query.bind(7, std::to_string(start_time, e.reaching_time));
-    if (e.needs_hospital)
-      query.bind(8, std::to_string(start_time, e.at_hospital_time));
-    else
-      query.bind(8, nullptr);
-    query.exec();
-    transaction.commit();
-  } catch (std::exception& ex) {
-    std::cerr << "ERROR in DB logging (rescue) " << ex.what() << std::endl;
-    std::cerr << e.id << "/" << a.id << std::endl;
-  }
+SimulationData::~SimulationData() {
+  close();
+}
+
+void SimulationData::close() {
+  if (!writer.joinable())
+    return;
+  closing = true;
+  writer.join();
+  spdlog::info("Simulation data: {} records, queue full {} times ({:.3f} s waited), at most {} of {} records queued", stats.records, stats.full_queue, stats.blocked_time, stats.max_queued, options.queue_size);
+  spdlog::info("Simulation data: {:.3f} s writing ({:.0f} records/s)", stats.write_time, stats.write_time > 0.0 ? stats.records / stats.write_time : 0.0);
 }
 
-void SimulationData::log_ambulance(const Ambulance& a, const Emergency& e, Time now, const pt::ptime& start_time) {
-  try {
-    if (!SimulationData::db)
-      return;
-    SQLite::Statement query(*SimulationData::db, "INSERT INTO ambulance_event VALUES (?, ?, ?, ?)");
-    SQLite::Transaction transaction(* SimulationData::db);
-    query.bind(1, a.id);
-    query.bind(2, e.id);
-    query.bind(3, std::to_string(a.current_state));
-    query.bind(4, std::to_string(start_time, now));
-    query.exec();
-    transaction.commit();
-  } catch (std::exception& ex) {
-    std::cerr << "ERROR in DB logging (ambulance) " << ex.what() << std::endl;
-    std::cerr << e.id << "/" << a.id << std::endl;
+void SimulationData::push(const DataRecord& r) {
+  if (!sink)
+    return;
+  stats.records++;
+  if (!queue.push(r)) {
+    // back-pressure: the writer is not keeping up with the simulation
+    auto start = std::chrono::steady_clock::now();
+    stats.full_queue++;
+    while (!queue.push(r))
+      std::this_thread::yield();
+    stats.blocked_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
   }
+  stats.max_queued = std::max(stats.max_queued, options.queue_size - queue.write_available());
 }
 
-void SimulationData::log_ambulance(const Ambulance& a, Time now, const pt::ptime& start_time) {
-  try {
-    if (!SimulationData::db)
-      return;
-    SQLite::Statement query(*SimulationData::db, "INSERT INTO ambulance_event VALUES (?, NULL, ?, ?)");
-    SQLite::Transaction transaction(* SimulationData::db);
-    query.bind(1, a.id);
-    query.bind(2, std::to_string(a.current_state));
-    query.bind(3, std::to_string(start_time, now));
-    query.exec();
-    transaction.commit();
-  } catch (std::exception& ex) {
-    std::cerr << "ERROR in DB logging (ambulance) " << ex.what() << std::endl;
-    std::cerr << a.id << std::endl;
+void SimulationData::write_records() {
+  DataRecord r;
+  // write_time is only updated here, it is read after the thread has been joined
+  double write_time = 0.0;
+  while (true) {
+    auto start = std::chrono::steady_clock::now();
+    bool written = false;
+    while (queue.pop(r)) {
+      if (batch_rows == 0)
+        batch_start = std::chrono::steady_clock::now();
+      sink->write(r);
+      if (++batch_rows >= options.batch_size || std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count() >= options.batch_interval)
+        flush();
+      written = true;
+    }
+    if (written) {
+      write_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      continue;
+    }
+    if (closing) {
+      // the simulation has ended, the last records could have been pushed after the previous check
+      while (queue.pop(r))
+        sink->write(r);
+      break;
+    }
+    if (batch_rows > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count() >= options.batch_interval)
+      flush();
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
   }
+  auto start = std::chrono::steady_clock::now();
+  flush();
+  write_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  stats.write_time = write_time;
+}
+
+void SimulationData::flush() {
+  sink->commit();
+  batch_rows = 0;
 }
 
-std::unique_ptr<SQLite::Database> SimulationData::db;
+void SimulationData::log_rescue(const Emergency& e, const Ambulance& a) {
+  DataRecord r{ DataRecord::RESCUE, std::uint8_t(e.triage), std::int32_t(a.index), std::int32_t(e.index), e.needs_hospital ? std::int32_t(e.assigned_hospital->index) : -1, { e.occurring_time, e.start_serving_time, e.reaching_time, e.at_hospital_time } };
+  push(r);
+}
+
+void SimulationData::log_ambulance(const Ambulance& a, const Emergency& e, Time now) {
+  DataRecord r{ DataRecord::AMBULANCE_EVENT, std::uint8_t(a.current_state), std::int32_t(a.index), std::int32_t(e.index), -1, { now } };
+  push(r);
+}
+
+void SimulationData::log_ambulance(const Ambulance& a, Time now) {
+  DataRecord r{ DataRecord::AMBULANCE_STATE, std::uint8_t(a.current_state), std::int32_t(a.index), -1, -1, { now } };
+  push(r);
+}
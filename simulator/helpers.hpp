@@ -7,11 +7,15 @@
 #include <boost/algorithm/string.hpp>
 #include <iostream>
 #include <functional>
-#include "SQLiteCpp/SQLiteCpp.h"
+#include "data_sink.hpp"
 #include "spdlog/fmt/ostr.h"
 #include "termcolor/termcolor.hpp"
 #include <unistd.h>
 #include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <boost/lockfree/spsc_queue.hpp>
 
 namespace std {
 
@@ -31,14 +35,47 @@ inline std::string to_string(const Emergency::Code& c) {
 
 }
 
+// Output of a simulation. The simulation only pushes fixed-size records on a
+// bounded (single producer, single consumer) lock-free queue, a writer thread
+// passes them to the sink (SQLite, CSV or columnar). The records are
+// committed in batches: a batch is closed when it reaches the given number of
+// rows or when it has been open for longer than the given (wall clock)
+// interval. When the queue is full the simulation waits for the writer, the
+// waits are accounted in the statistics. Without a sink nothing is recorded.
 class SimulationData {
 public:
-  static void set_database(std::string db_filename);
-  static void log_rescue(const Emergency& e, const Ambulance& a, const pt::ptime& start_time);
-  static void log_ambulance(const Ambulance& a, const Emergency& e, Time now, const pt::ptime& start_time);
-  static void log_ambulance(const Ambulance& a, Time now, const pt::ptime& start_time);
+  struct Options {
+    std::size_t batch_size = 1000;
+    // interval is expressed in seconds
+    double batch_interval = 1.0;
+    std::size_t queue_size = 1 << 16;
+  };
+  struct Statistics {
+    std::size_t records = 0, full_queue = 0, max_queued = 0;
+    // time spent by the simulation waiting for the writer and by the writer
+    // in the sink, expressed in seconds
+    double blocked_time = 0.0, write_time = 0.0;
+  };
+  SimulationData(std::unique_ptr<DataSink> sink, const Options& options);
+  ~SimulationData();
+  void log_rescue(const Emergency& e, const Ambulance& a);
+  void log_ambulance(const Ambulance& a, const Emergency& e, Time now);
+  void log_ambulance(const Ambulance& a, Time now);
+  // writes all the pending records and stops the writer thread
+  void close();
+  inline const Statistics& statistics() const { return stats; }
 protected:
-  static std::unique_ptr<SQLite::Database> db;
+  void push(const DataRecord& r);
+  void write_records();
+  void flush();
+  Options options;
+  std::unique_ptr<DataSink> sink;
+  std::size_t batch_rows;
+  std::chrono::steady_clock::time_point batch_start;
+  boost::lockfree::spsc_queue<DataRecord> queue;
+  std::atomic<bool> closing;
+  std::thread writer;
+  Statistics stats;
 };
 
 template <typename OStream>
@@ -49,7 +86,7 @@ OStream& operator<<(OStream &os, const Hospital& h) {
 
 template <typename OStream>
 OStream& operator<<(OStream &os, const Emergency& e) {
-  if (colored)
+  if (e.context.colored)
     os << termcolor::colorize << termcolor::bold;
   switch (e.triage) {
     case Emergency::Code::RED:
@@ -69,14 +106,14 @@ OStream& operator<<(OStream &os, const Emergency& e) {
       break;
   }
   os << e.id << "[" << e.municipality << ", " << e.triage << ", " << e.needed_hospital << "]";
-  if (colored)
+  if (e.context.colored)
     os << termcolor::reset;
   return os;
 }
 
 template <typename OStream>
 OStream& operator<<(OStream &os, const Ambulance& a) {
-  if (colored)
+  if (a.context.colored)
     os << termcolor::colorize << termcolor::bold;
   switch (a.type) {
     case Ambulance::Type::ALS:
@@ -90,7 +127,7 @@ OStream& operator<<(OStream &os, const Ambulance& a) {
       break;
   }
   os << a.id << "[" << a.description << ", " << a.type << "]";
-  if (colored)
+  if (a.context.colored)
     os << termcolor::reset;
   return os;
 }
@@ -102,9 +139,6 @@ inline bool compatible(Ambulance::Type t, Emergency::Code c) {
     return t == Ambulance::Type::BLS;
 }
 
-extern units::length::kilometer_t DISTANCE_THRESHOLD;
-extern units::time::minute_t TIME_THRESHOLD;
-
 const Time SERVICE_TIME_THRESHOLD = 18*60;
 const Time DISCHARGING_TIME = 3 * 60;
 const Time CLEANING_TIME = 10 * 60;
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Streaming histogram of non-negative integer values (e.g., times in
+// seconds) with log-linear buckets, as in HDR histograms: values below
+// SUB_BUCKETS are counted exactly, larger values in buckets whose width is
+// at most 1/(SUB_BUCKETS/2) of their value, so that percentiles are known
+// within about 3% with constant memory (a few hundred counters).
+class Histogram {
+public:
+  static constexpr unsigned int PRECISION = 6;
+  static constexpr std::uint64_t SUB_BUCKETS = 1 << PRECISION;
+
+  Histogram() : count_(0), sum(0.0), min_(std::numeric_limits<std::uint64_t>::max()), max_(0) {}
+
+  void add(std::int64_t value) {
+    auto v = std::uint64_t(std::max<std::int64_t>(value, 0));
+    auto i = index(v);
+    if (i >= counts.size())
+      counts.resize(i + 1, 0);
+    counts[i]++;
+    count_++;
+    sum += v;
+    min_ = std::min(min_, v);
+    max_ = std::max(max_, v);
+  }
+
+  inline std::uint64_t count() const { return count_; }
+  inline double mean() const { return count_ > 0 ? sum / count_ : 0.0; }
+  inline std::uint64_t min() const { return count_ > 0 ? min_ : 0; }
+  inline std::uint64_t max() const { return max_; }
+
+  // value below which the given fraction (between 0 and 1) of the values lies,
+  // estimated as the middle of the bucket (clamped to the observed range)
+  std::uint64_t percentile(double q) const {
+    if (count_ == 0)
+      return 0;
+    auto rank = std::uint64_t(std::max(1.0, q * count_ + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        auto [lower, upper] = bounds(i);
+        return std::clamp(lower + (upper - lower) / 2, min_, max_);
+      }
+    }
+    return max_;
+  }
+
+protected:
+  // the first bucket has SUB_BUCKETS unit-wide slots, each following bucket
+  // doubles the width and the values range with SUB_BUCKETS/2 slots
+  static std::size_t index(std::uint64_t v) {
+    unsigned int bucket = std::max<int>(0, int(std::bit_width(v)) - int(PRECISION));
+    return bucket * (SUB_BUCKETS / 2) + (v >> bucket);
+  }
+
+  static std::pair<std::uint64_t, std::uint64_t> bounds(std::size_t i) {
+    unsigned int bucket = i < SUB_BUCKETS ? 0 : (i - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+    std::uint64_t sub = i - bucket * (SUB_BUCKETS / 2);
+    return { sub << bucket, ((sub + 1) << bucket) - 1 };
+  }
+
+  std::vector<std::uint64_t> counts;
+  std::uint64_t count_;
+  double sum;
+  std::uint64_t min_, max_;
+};
@@ -41,21 +41,3 @@ std::istream &operator>>(std::istream &is, Hospital &h)
   return is;
 }
 
-void Hospital::source(std::istream &is)
-{
-  while (!is.eof())
-  {
-    std::string tmp;
-    std::getline(is, tmp);
-    boost::trim(tmp);
-    if (tmp == "")
-      break;
-    auto h = std::make_shared<Hospital>();
-    std::istringstream iss(tmp);
-    iss >> *h;
-    h->index = hospitals.size();
-    hospitals.emplace_back(h);
-  }
-}
-
-std::vector<std::shared_ptr<Hospital>> Hospital::hospitals;
@@ -4,7 +4,6 @@
 #include "routing.hpp"
 
 class Hospital {
-  friend class Ambulance;
 public:
   size_t index;
   enum Type {
@@ -17,9 +16,6 @@ public:
   std::string description;
   Coordinate place;
   Type type;
-  static void source(std::istream &is);
-protected:
-  static std::vector<std::shared_ptr<Hospital>> hospitals;
 };
 
 std::ostream &operator<<(std::ostream &os, const Hospital::Type &type);
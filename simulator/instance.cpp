@@ -0,0 +1,489 @@
+#include "instance.hpp"
+#include "helpers.hpp"
+#include "mapped_file.hpp"
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <chrono>
+
+static const char INSTANCE_MAGIC[8] = { 'E', 'M', 'S', 'I', 'N', 'S', 'T', 'C' };
+// marks a missing string or code in the binary instance files
+static const std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+
+static inline std::size_t aligned(std::size_t size)
+{
+  return (size + 7) & ~std::size_t(7);
+}
+
+// Tokenization helpers for the memory-mapped parser: fields are views on the
+// mapped file and numbers are converted with from_chars, with no copies.
+
+// next field of a line separated by blanks, the line is consumed up to the field end
+static std::string_view next_word(std::string_view& line)
+{
+  std::size_t start = line.find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    line = std::string_view();
+    return line;
+  }
+  std::size_t end = line.find_first_of(" \t", start);
+  if (end == std::string_view::npos)
+    end = line.size();
+  auto word = line.substr(start, end - start);
+  line.remove_prefix(end);
+  return word;
+}
+
+// next field of a comma-separated line (possibly quoted, with no escaped quotes)
+static std::string_view next_field(std::string_view& line)
+{
+  std::string_view field;
+  if (!line.empty() && line.front() == '"') {
+    std::size_t end = line.find('"', 1);
+    if (end == std::string_view::npos)
+      throw std::logic_error("Unterminated quoted field");
+    field = line.substr(1, end - 1);
+    line.remove_prefix(end + 1);
+  } else {
+    std::size_t end = line.find(',');
+    field = line.substr(0, end);
+    line.remove_prefix(end == std::string_view::npos ? line.size() : end);
+  }
+  if (!line.empty() && line.front() == ',')
+    line.remove_prefix(1);
+  return field;
+}
+
+template <typename T>
+static T parse_number(std::string_view s)
+{
+  T value;
+  auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (error != std::errc() || end != s.data() + s.size())
+    throw std::logic_error("Number (" + std::string(s) + ") not recognized");
+  return value;
+}
+
+// the fixed layout YYYY-MM-DD HH:MM:SS
+static pt::ptime parse_timestamp(std::string_view s)
+{
+  if (s.size() != 19 || s[4] != '-' || s[7] != '-' || s[10] != ' ' || s[13] != ':' || s[16] != ':')
+    throw std::logic_error("Timestamp (" + std::string(s) + ") not recognized");
+  auto year = parse_number<unsigned short>(s.substr(0, 4));
+  auto month = parse_number<unsigned short>(s.substr(5, 2));
+  auto day = parse_number<unsigned short>(s.substr(8, 2));
+  auto hours = parse_number<long>(s.substr(11, 2));
+  auto minutes = parse_number<long>(s.substr(14, 2));
+  auto seconds = parse_number<long>(s.substr(17, 2));
+  return pt::ptime(boost::gregorian::date(year, month, day), pt::time_duration(hours, minutes, seconds));
+}
+
+static Coordinate parse_coordinate(std::string_view lat, std::string_view lon)
+{
+  return Coordinate{osrm::util::FloatLongitude{parse_number<float>(lon)}, osrm::util::FloatLatitude{parse_number<float>(lat)}};
+}
+
+static Emergency::Code parse_triage(std::string_view s)
+{
+  if (s == "RED")
+    return Emergency::Code::RED;
+  else if (s == "YELLOW")
+    return Emergency::Code::YELLOW;
+  else if (s == "GREEN")
+    return Emergency::Code::GREEN;
+  else if (s == "WHITE")
+    return Emergency::Code::WHITE;
+  else if (s == "BLACK")
+    return Emergency::Code::BLACK;
+  else
+    throw std::logic_error("Triage type (" + std::string(s) + ") not recognized");
+}
+
+static Hospital::Type parse_hospital_type(std::string_view s)
+{
+  if (s == "H")
+    return Hospital::Type::HUB;
+  else if (s == "S")
+    return Hospital::Type::SPOKE;
+  else if (s == "PPI")
+    return Hospital::Type::FIP;
+  else if (s == "K")
+    return Hospital::Type::PEDIATRIC;
+  else
+    throw std::logic_error("Hospital type (" + std::string(s) + ") not recognized");
+}
+
+// id municipality TRIAGE lat,lon PRIORITY YYYY-MM-DD HH:MM:SS [hospital_type hospital]
+void Instance::parse_txt_emergency(std::string_view line)
+{
+  EmergencyRecord e;
+  e.id = next_word(line);
+  e.municipality = next_word(line);
+  e.triage = parse_triage(next_word(line));
+  auto place = next_word(line);
+  auto comma = place.find(',');
+  if (comma == std::string_view::npos)
+    throw std::logic_error("Coordinate (" + std::string(place) + ") not recognized");
+  e.place = parse_coordinate(place.substr(0, comma), place.substr(comma + 1));
+  next_word(line);
+  auto date = next_word(line);
+  auto time = next_word(line);
+  if (time.empty() || time.data() != date.data() + date.size() + 1)
+    throw std::logic_error("Timestamp (" + std::string(date) + " " + std::string(time) + ") not recognized");
+  e.timestamp = parse_timestamp(std::string_view(date.data(), date.size() + 1 + time.size()));
+  auto needed_hospital = next_word(line);
+  e.needs_hospital = !needed_hospital.empty();
+  if (e.needs_hospital) {
+    e.needed_hospital = parse_hospital_type(needed_hospital);
+    e.actual_hospital = next_word(line);
+  }
+  emergencies.push_back(std::move(e));
+}
+
+// ,municipality_code,transport_code,municipality,urgency_code,lat,lon,date_time,destination_hospital,real_hospital
+void Instance::parse_csv_emergency(std::string_view line)
+{
+  EmergencyRecord e;
+  next_field(line);
+  next_field(line);
+  e.id = next_field(line);
+  // municipality names have underscores in place of blanks, as in the TXT format
+  e.municipality = next_field(line);
+  std::replace(e.municipality.begin(), e.municipality.end(), ' ', '_');
+  e.triage = parse_triage(next_field(line));
+  auto lat = next_field(line);
+  auto lon = next_field(line);
+  e.place = parse_coordinate(lat, lon);
+  e.timestamp = parse_timestamp(next_field(line));
+  auto needed_hospital = next_field(line);
+  e.needs_hospital = !needed_hospital.empty();
+  if (e.needs_hospital) {
+    e.needed_hospital = parse_hospital_type(needed_hospital);
+    e.actual_hospital = next_field(line);
+  }
+  emergencies.push_back(std::move(e));
+}
+
+bool Instance::load_emergencies(const std::string& filename)
+{
+  MappedFile file;
+  if (!file.open(filename))
+    return false;
+  std::string_view text(file.data(), file.size());
+  bool csv = text.starts_with(",municipality_code,") || text.starts_with("municipality_code,");
+  bool header = csv;
+  std::size_t line_number = 0;
+  while (!text.empty())
+  {
+    std::size_t end = text.find('\n');
+    auto line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    line_number++;
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (header) {
+      header = false;
+      continue;
+    }
+    if (line.find_first_not_of(" \t") == std::string_view::npos)
+      continue;
+    try
+    {
+      if (csv)
+        parse_csv_emergency(line);
+      else
+        parse_txt_emergency(line);
+    }
+    catch (std::exception &ex)
+    {
+      spdlog::error("An exception occurred while reading emergencies file {} (line {}) {}", filename, line_number, ex.what());
+    }
+  }
+  return true;
+}
+
+void Instance::read_ambulances(std::istream& is)
+{
+  while (!is.eof())
+  {
+    // id description TYPE lat,lon HH:MM HH:MM (shift times are stored in seconds from midnight)
+    AmbulanceRecord a;
+    unsigned long hours, minutes;
+    std::string tmp;
+    is >> a.id >> a.description >> a.type >> a.base;
+    std::getline(is, tmp, ':');
+    hours = std::stoul(tmp);
+    std::getline(is, tmp, ' ');
+    minutes = std::stoul(tmp);
+    a.shift_start = (hours * 60 + minutes) * 60; // TODO: time granularity is fixed to second
+    std::getline(is, tmp, ':');
+    hours = std::stoul(tmp);
+    std::getline(is, tmp);
+    minutes = std::stoul(tmp);
+    a.shift_end = (hours * 60 + minutes) * 60; // TODO: time granularity is fixed to second
+    ambulances.push_back(a);
+  }
+#ifdef LOGGING
+  spdlog::debug("Read {} ambulances", ambulances.size());
+#endif
+}
+
+void Instance::read_hospitals(std::istream& is)
+{
+  while (!is.eof())
+  {
+    std::string tmp;
+    std::getline(is, tmp);
+    boost::trim(tmp);
+    if (tmp == "")
+      break;
+    auto h = std::make_shared<Hospital>();
+    std::istringstream iss(tmp);
+    iss >> *h;
+    h->index = hospitals.size();
+    hospitals.emplace_back(h);
+  }
+}
+
+// columns of the binary files are padded to 8 bytes
+template <typename T>
+static void write_column(std::ostream& os, const std::vector<T>& column)
+{
+  os.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+  static const char padding[8] = {};
+  os.write(padding, aligned(column.size() * sizeof(T)) - column.size() * sizeof(T));
+}
+
+template <typename T>
+static const T* read_column(const char*& p, std::size_t n)
+{
+  const T* column = reinterpret_cast<const T*>(p);
+  p += aligned(n * sizeof(T));
+  return column;
+}
+
+bool Instance::save(const std::string& filename) const
+{
+  std::vector<std::uint32_t> string_offsets{ 0 };
+  std::string string_bytes;
+  std::unordered_map<std::string, std::uint32_t> interned;
+  auto intern = [&](const std::string& s) {
+    auto [it, added] = interned.try_emplace(s, string_offsets.size() - 1);
+    if (added) {
+      string_bytes += s;
+      string_offsets.push_back(string_bytes.size());
+    }
+    return it->second;
+  };
+  // the earliest emergency, so that offsets are small and non-negative
+  pt::ptime epoch(boost::gregorian::date(1970, 1, 1));
+  for (std::size_t i = 0; i < emergencies.size(); i++)
+    if (i == 0 || emergencies[i].timestamp < epoch)
+      epoch = emergencies[i].timestamp;
+  
+  std::vector<std::uint32_t> e_id, e_municipality, e_hospital, e_time;
+  std::vector<float> e_lat, e_lon;
+  std::vector<std::uint8_t> e_triage, e_hospital_type;
+  for (const auto& e : emergencies)
+  {
+    e_id.push_back(intern(e.id));
+    e_municipality.push_back(intern(e.municipality));
+    e_hospital.push_back(e.needs_hospital ? intern(e.actual_hospital) : NONE);
+    e_time.push_back((e.timestamp - epoch).total_seconds());
+    e_lat.push_back(e.place.lat.__value);
+    e_lon.push_back(e.place.lon.__value);
+    e_triage.push_back(e.triage);
+    e_hospital_type.push_back(e.needs_hospital ? e.needed_hospital : 0xff);
+  }
+  std::vector<std::uint32_t> a_id, a_description;
+  std::vector<float> a_lat, a_lon;
+  std::vector<std::int32_t> a_shift_start, a_shift_end;
+  std::vector<std::uint8_t> a_type;
+  for (const auto& a : ambulances)
+  {
+    a_id.push_back(intern(a.id));
+    a_description.push_back(intern(a.description));
+    a_lat.push_back(a.base.lat.__value);
+    a_lon.push_back(a.base.lon.__value);
+    a_shift_start.push_back(a.shift_start);
+    a_shift_end.push_back(a.shift_end);
+    a_type.push_back(a.type);
+  }
+  std::vector<std::uint32_t> h_id, h_description;
+  std::vector<float> h_lat, h_lon;
+  std::vector<std::uint8_t> h_type;
+  for (const auto& h : hospitals)
+  {
+    h_id.push_back(intern(h->id));
+    h_description.push_back(intern(h->description));
+    h_lat.push_back(h->place.lat.__value);
+    h_lon.push_back(h->place.lon.__value);
+    h_type.push_back(h->type);
+  }
+  
+  std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+  if (!os)
+    return false;
+  FileHeader header{};
+  std::memcpy(header.magic, INSTANCE_MAGIC, sizeof(INSTANCE_MAGIC));
+  header.version = FILE_VERSION;
+  header.strings = string_offsets.size() - 1;
+  header.string_bytes = string_bytes.size();
+  header.emergencies = emergencies.size();
+  header.ambulances = ambulances.size();
+  header.hospitals = hospitals.size();
+  header.epoch = (epoch - pt::ptime(boost::gregorian::date(1970, 1, 1))).total_seconds();
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  write_column(os, string_offsets);
+  write_column(os, std::vector<char>(string_bytes.begin(), string_bytes.end()));
+  write_column(os, e_id);
+  write_column(os, e_municipality);
+  write_column(os, e_hospital);
+  write_column(os, e_time);
+  write_column(os, e_lat);
+  write_column(os, e_lon);
+  write_column(os, e_triage);
+  write_column(os, e_hospital_type);
+  write_column(os, a_id);
+  write_column(os, a_description);
+  write_column(os, a_lat);
+  write_column(os, a_lon);
+  write_column(os, a_shift_start);
+  write_column(os, a_shift_end);
+  write_column(os, a_type);
+  write_column(os, h_id);
+  write_column(os, h_description);
+  write_column(os, h_lat);
+  write_column(os, h_lon);
+  write_column(os, h_type);
+  return bool(os);
+}
+
+bool Instance::open(const std::string& filename)
+{
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(filename))
+  {
+    spdlog::error("Could not open instance file {}", filename);
+    return false;
+  }
+  FileHeader header;
+  if (file.size() < sizeof(header))
+  {
+    spdlog::error("Instance file {} is not valid", filename);
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (!std::equal(header.magic, header.magic + sizeof(header.magic), INSTANCE_MAGIC) || header.version != FILE_VERSION)
+  {
+    spdlog::error("Instance file {} is not valid (or has an unsupported version)", filename);
+    return false;
+  }
+  std::size_t ne = header.emergencies, na = header.ambulances, nh = header.hospitals;
+  // counts larger than the file would overflow the expected size
+  if (header.strings >= file.size() || header.string_bytes > file.size() || ne > file.size() || na > file.size() || nh > file.size())
+  {
+    spdlog::error("Instance file {} is not valid", filename);
+    return false;
+  }
+  std::size_t size = sizeof(header) + aligned((header.strings + 1) * 4) + aligned(header.string_bytes)
+    + 6 * aligned(ne * 4) + 2 * aligned(ne)
+    + 6 * aligned(na * 4) + aligned(na)
+    + 4 * aligned(nh * 4) + aligned(nh);
+  if (file.size() != size)
+  {
+    spdlog::error("Instance file {} is truncated", filename);
+    return false;
+  }
+  const char* p = file.data() + sizeof(header);
+  const auto* string_offsets = read_column<std::uint32_t>(p, header.strings + 1);
+  const auto* string_bytes = read_column<char>(p, header.string_bytes);
+  
+  const auto* e_id = read_column<std::uint32_t>(p, ne);
+  const auto* e_municipality = read_column<std::uint32_t>(p, ne);
+  const auto* e_hospital = read_column<std::uint32_t>(p, ne);
+  const auto* e_time = read_column<std::uint32_t>(p, ne);
+  const auto* e_lat = read_column<float>(p, ne);
+  const auto* e_lon = read_column<float>(p, ne);
+  const auto* e_triage = read_column<std::uint8_t>(p, ne);
+  const auto* e_hospital_type = read_column<std::uint8_t>(p, ne);
+  
+  const auto* a_id = read_column<std::uint32_t>(p, na);
+  const auto* a_description = read_column<std::uint32_t>(p, na);
+  const auto* a_lat = read_column<float>(p, na);
+  const auto* a_lon = read_column<float>(p, na);
+  const auto* a_shift_start = read_column<std::int32_t>(p, na);
+  const auto* a_shift_end = read_column<std::int32_t>(p, na);
+  const auto* a_type = read_column<std::uint8_t>(p, na);
+  
+  const auto* h_id = read_column<std::uint32_t>(p, nh);
+  const auto* h_description = read_column<std::uint32_t>(p, nh);
+  const auto* h_lat = read_column<float>(p, nh);
+  const auto* h_lon = read_column<float>(p, nh);
+  const auto* h_type = read_column<std::uint8_t>(p, nh);
+  
+  // string indices, string offsets and codes are checked before anything is built
+  bool valid = string_offsets[0] == 0 && string_offsets[header.strings] <= header.string_bytes;
+  for (std::size_t i = 0; valid && i < header.strings; i++)
+    valid = string_offsets[i] <= string_offsets[i + 1];
+  auto valid_string = [&header](std::uint32_t i) { return i < header.strings; };
+  for (std::size_t i = 0; valid && i < ne; i++)
+    valid = valid_string(e_id[i]) && valid_string(e_municipality[i]) && e_triage[i] <= Emergency::BLACK
+      && (e_hospital[i] == NONE || (valid_string(e_hospital[i]) && e_hospital_type[i] <= Hospital::PEDIATRIC));
+  for (std::size_t i = 0; valid && i < na; i++)
+    valid = valid_string(a_id[i]) && valid_string(a_description[i]) && a_type[i] <= Ambulance::MV;
+  for (std::size_t i = 0; valid && i < nh; i++)
+    valid = valid_string(h_id[i]) && valid_string(h_description[i]) && h_type[i] <= Hospital::PEDIATRIC;
+  if (!valid)
+  {
+    spdlog::error("Instance file {} is not valid", filename);
+    return false;
+  }
+  
+  auto string = [&](std::uint32_t i) { return std::string(string_bytes + string_offsets[i], string_offsets[i + 1] - string_offsets[i]); };
+  auto coordinate = [](float lat, float lon) { return Coordinate{osrm::util::FloatLongitude{lon}, osrm::util::FloatLatitude{lat}}; };
+  pt::ptime epoch = pt::ptime(boost::gregorian::date(1970, 1, 1)) + pt::seconds(header.epoch);
+  emergencies.resize(ne);
+  for (std::size_t i = 0; i < ne; i++)
+  {
+    auto& e = emergencies[i];
+    e.id = string(e_id[i]);
+    e.municipality = string(e_municipality[i]);
+    e.triage = Emergency::Code(e_triage[i]);
+    e.place = coordinate(e_lat[i], e_lon[i]);
+    e.timestamp = epoch + pt::seconds(e_time[i]);
+    e.needs_hospital = e_hospital[i] != NONE;
+    if (e.needs_hospital) {
+      e.needed_hospital = Hospital::Type(e_hospital_type[i]);
+      e.actual_hospital = string(e_hospital[i]);
+    }
+  }
+  
+  ambulances.resize(na);
+  for (std::size_t i = 0; i < na; i++)
+  {
+    auto& a = ambulances[i];
+    a.id = string(a_id[i]);
+    a.description = string(a_description[i]);
+    a.type = Ambulance::Type(a_type[i]);
+    a.base = coordinate(a_lat[i], a_lon[i]);
+    a.shift_start = a_shift_start[i];
+    a.shift_end = a_shift_end[i];
+  }
+  
+  for (std::size_t i = 0; i < nh; i++)
+  {
+    auto h = std::make_shared<Hospital>();
+    h->id = string(h_id[i]);
+    h->description = string(h_description[i]);
+    h->place = coordinate(h_lat[i], h_lon[i]);
+    h->type = Hospital::Type(h_type[i]);
+    h->index = hospitals.size();
+    hospitals.emplace_back(h);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  spdlog::info("Instance loaded from {} ({} emergencies, {} ambulances, {} hospitals) in {} ms", filename, ne, na, nh, elapsed.count());
+  return true;
+}
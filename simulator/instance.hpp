@@ -0,0 +1,63 @@
+#pragma once
+
+#include "data.hpp"
+#include "emergency.hpp"
+#include "ambulance.hpp"
+#include "hospital.hpp"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Input data of a scenario (emergencies, ambulances and hospitals), read once
+// and shared read-only among the simulations that are built from it.
+class Instance {
+public:
+  struct EmergencyRecord {
+    std::string id;
+    std::string municipality;
+    Emergency::Code triage;
+    Coordinate place;
+    pt::ptime timestamp;
+    bool needs_hospital;
+    Hospital::Type needed_hospital;
+    std::string actual_hospital;
+  };
+  struct AmbulanceRecord {
+    std::string id;
+    std::string description;
+    Ambulance::Type type;
+    Coordinate base;
+    // shift times are expressed in seconds from midnight
+    Time shift_start, shift_end;
+  };
+  
+  // reads the emergencies from a memory-mapped file, either in the TXT or in the CSV
+  // format (recognized by its header), returns false if the file cannot be opened
+  bool load_emergencies(const std::string& filename);
+  void read_ambulances(std::istream& is);
+  void read_hospitals(std::istream& is);
+  
+  // binary instance files (written by the convert tool): strings are interned,
+  // times are offsets in seconds from an epoch, codes and coordinates are stored
+  // as fixed-size columns, so that the file is loaded with no parsing
+  bool save(const std::string& filename) const;
+  bool open(const std::string& filename);
+  
+  std::vector<EmergencyRecord> emergencies;
+  std::vector<AmbulanceRecord> ambulances;
+  // hospitals are not modified by the simulations
+  std::vector<std::shared_ptr<Hospital>> hospitals;
+protected:
+  struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t strings, string_bytes, emergencies, ambulances, hospitals;
+    // seconds from the UNIX epoch of the time offsets
+    std::int64_t epoch;
+  };
+  static constexpr std::uint32_t FILE_VERSION = 1;
+  void parse_txt_emergency(std::string_view line);
+  void parse_csv_emergency(std::string_view line);
+};
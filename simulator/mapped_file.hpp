@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. Pages are shared among the
+// processes mapping the same file.
+class MappedFile {
+public:
+  MappedFile() : data_(nullptr), size_(0) {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const std::string& filename)
+  {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+    return true;
+  }
+
+  void close()
+  {
+    if (data_)
+      munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  inline const char* data() const { return data_; }
+  inline std::size_t size() const { return size_; }
+  inline bool is_open() const { return data_ != nullptr; }
+protected:
+  const char* data_;
+  std::size_t size_;
+};
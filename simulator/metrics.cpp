@@ -0,0 +1,88 @@
+#include "metrics.hpp"
+#include "helpers.hpp"
+
+void Metrics::emergency_reached(const Emergency& e, Time now) {
+  auto response_time = now - e.occurring_time;
+  // as for the warnings in the log, the threshold applies to RED and YELLOW emergencies only
+  bool violation = e.triage != Emergency::GREEN && e.triage != Emergency::WHITE && response_time > SERVICE_TIME_THRESHOLD;
+  for (auto i : { &overall, &by_triage[e.triage], &by_municipality[e.municipality] }) {
+    i->response_time.add(response_time);
+    i->violations += violation;
+  }
+}
+
+void Metrics::emergency_at_hospital(const Emergency& e, const Hospital& h, Time now) {
+  auto hospital_time = now - e.occurring_time;
+  for (auto i : { &overall, &by_triage[e.triage], &by_municipality[e.municipality], &by_hospital[h.id] })
+    i->hospital_time.add(hospital_time);
+}
+
+void Metrics::log_summary() const {
+  auto log = [](const std::string& name, const Indicators& i) {
+    const auto& r = i.response_time;
+    const auto& h = i.hospital_time;
+    spdlog::info("{:<8} {:>7} reached, response time mean {:.0f} s, p50 {} s, p90 {} s, p99 {} s, {:.1f}% over threshold; {:>7} at hospital, p50 {} s, p90 {} s", name, r.count(), r.mean(), r.percentile(0.5), r.percentile(0.9), r.percentile(0.99), r.count() > 0 ? 100.0 * i.violations / r.count() : 0.0, h.count(), h.percentile(0.5), h.percentile(0.9));
+  };
+  log("ALL", overall);
+  for (int c = Emergency::RED; c <= Emergency::BLACK; c++)
+    if (by_triage[c].response_time.count() > 0)
+      log(std::to_string(Emergency::Code(c)), by_triage[c]);
+}
+
+static void write_json_string(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (auto c : s) {
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      os << ' ';
+    else
+      os << c;
+  }
+  os << '"';
+}
+
+void Metrics::write_json(std::ostream& os, const Histogram& h) {
+  os << "{\"count\": " << h.count() << ", \"mean\": " << h.mean() << ", \"min\": " << h.min();
+  for (auto [name, q] : { std::pair{ "p50", 0.5 }, { "p90", 0.9 }, { "p95", 0.95 }, { "p99", 0.99 } })
+    os << ", \"" << name << "\": " << h.percentile(q);
+  os << ", \"max\": " << h.max() << "}";
+}
+
+void Metrics::write_json(std::ostream& os, const Indicators& i) {
+  os << "{\"response_time\": ";
+  write_json(os, i.response_time);
+  os << ", \"violations\": " << i.violations << ", \"violation_share\": " << (i.response_time.count() > 0 ? double(i.violations) / i.response_time.count() : 0.0);
+  os << ", \"hospital_time\": ";
+  write_json(os, i.hospital_time);
+  os << "}";
+}
+
+void Metrics::write_json(std::ostream& os, const std::map<std::string, Indicators>& indicators) {
+  os << "{";
+  bool first = true;
+  for (const auto& [name, i] : indicators) {
+    os << (first ? "\n    " : ",\n    ");
+    write_json_string(os, name);
+    os << ": ";
+    write_json(os, i);
+    first = false;
+  }
+  os << "\n  }";
+}
+
+void Metrics::write_json(std::ostream& os) const {
+  os << "{\n  \"service_time_threshold\": " << SERVICE_TIME_THRESHOLD << ",\n  \"overall\": ";
+  write_json(os, overall);
+  std::map<std::string, Indicators> triages;
+  for (int c = Emergency::RED; c <= Emergency::BLACK; c++)
+    if (by_triage[c].response_time.count() > 0 || by_triage[c].hospital_time.count() > 0)
+      triages[std::to_string(Emergency::Code(c))] = by_triage[c];
+  os << ",\n  \"triage\": ";
+  write_json(os, triages);
+  os << ",\n  \"municipality\": ";
+  write_json(os, by_municipality);
+  os << ",\n  \"hospital\": ";
+  write_json(os, by_hospital);
+  os << "\n}\n";
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "data.hpp"
+#include "emergency.hpp"
+#include "histogram.hpp"
+#include <array>
+#include <map>
+#include <ostream>
+
+// Key performance indicators of a simulation, aggregated online as the
+// emergencies are reached and brought to the hospitals: response times (from
+// the call to the arrival of the first ambulance), violations of the service
+// time threshold and times to the hospital (from the call), overall and by
+// triage, municipality and hospital. Times are in seconds.
+class Metrics {
+public:
+  Metrics() : by_triage{} {}
+  void emergency_reached(const Emergency& e, Time now);
+  void emergency_at_hospital(const Emergency& e, const Hospital& h, Time now);
+  void log_summary() const;
+  void write_json(std::ostream& os) const;
+protected:
+  struct Indicators {
+    Histogram response_time, hospital_time;
+    std::size_t violations = 0;
+  };
+  static void write_json(std::ostream& os, const Histogram& h);
+  static void write_json(std::ostream& os, const Indicators& i);
+  static void write_json(std::ostream& os, const std::map<std::string, Indicators>& indicators);
+  Indicators overall;
+  std::array<Indicators, Emergency::BLACK + 1> by_triage;
+  std::map<std::string, Indicators> by_municipality, by_hospital;
+};
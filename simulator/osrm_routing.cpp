@@ -0,0 +1,127 @@
+#include "osrm_routing.hpp"
+#include "data.hpp"
+#include "spdlog/spdlog.h"
+
+#include "osrm/json_container.hpp"
+
+#include "osrm/route_parameters.hpp"
+#include "osrm/table_parameters.hpp"
+#include "osrm/status.hpp"
+
+bool OSRMRouting::compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances)
+{
+  osrm::TableParameters params;
+  size_t current = 0;
+  for (const auto & p : sources)
+  {
+    params.coordinates.emplace_back(p);
+    params.sources.push_back(current++);
+  }
+  for (const auto & p : destinations)
+  {
+    params.coordinates.emplace_back(p);
+    params.destinations.push_back(current++);
+  }
+  params.annotations = osrm::TableParameters::AnnotationsType::All;
+  params.fallback_coordinate_type = osrm::TableParameters::FallbackCoordinateType::Snapped;
+  osrm::engine::api::ResultT result = osrm::json::Object();
+  const auto status = osrm.Table(params, result);
+  if (status != osrm::Status::Ok)
+  {
+    spdlog::error("Error computing table routing ({}) {}", result.get<osrm::json::Object>().values["code"].get<osrm::json::String>().value, result.get<osrm::json::Object>().values["message"].get<osrm::json::String>().value);
+    return false;
+  }
+  
+  // the result arrays are only read by reference, the numbers go straight into the flat buffers
+  const auto& values = result.get<osrm::json::Object>().values;
+  const auto& computed_durations = values.at("durations").get<osrm::json::Array>().values;
+  const auto& computed_distances = values.at("distances").get<osrm::json::Array>().values;
+  durations.resize(sources.size() * destinations.size());
+  distances.resize(sources.size() * destinations.size());
+  float* duration_row = durations.data();
+  float* distance_row = distances.data();
+  for (size_t s = 0; s < params.sources.size(); s++)
+  {
+    const auto& computed_durations_s = computed_durations[s].get<osrm::json::Array>().values;
+    const auto& computed_distances_s = computed_distances[s].get<osrm::json::Array>().values;
+    for (size_t d = 0; d < params.destinations.size(); d++)
+    {
+      // duration is in seconds and distance in meters
+      duration_row[d] = computed_durations_s[d].get<osrm::json::Number>().value;
+      distance_row[d] = computed_distances_s[d].get<osrm::json::Number>().value;
+    }
+    duration_row += destinations.size();
+    distance_row += destinations.size();
+  }
+  
+  return true;
+}
+
+std::list<Routing::Segment> OSRMRouting::compute_route(const Coordinate& start_point, const Coordinate& end_point)
+{
+  osrm::RouteParameters params;
+  params.steps = true;
+  params.alternatives = false;
+//  params.annotations = true;
+//  params.annotations_type = osrm::RouteParameters::AnnotationsType::Duration | osrm::RouteParameters::AnnotationsType::Distance;
+  params.overview = osrm::RouteParameters::OverviewType::False;
+  params.geometries = osrm::RouteParameters::GeometriesType::GeoJSON;
+  params.coordinates.emplace_back(start_point);
+  params.coordinates.emplace_back(end_point);
+  osrm::engine::api::ResultT result = osrm::json::Object();
+
+  auto status = osrm.Route(params, result);
+  if (status != osrm::Status::Ok)
+  {
+    spdlog::error("Error computing route ({}) {}",
+                  result.get<osrm::json::Object>().values["code"].get<osrm::json::String>().value,
+                  result.get<osrm::json::Object>().values["message"].get<osrm::json::String>().value);
+    return {};
+  }
+  // get the steps of the route (by reference, nothing is copied out of the result)
+  const auto& legs = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("legs").get<osrm::json::Array>().values;
+//  auto durations = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("duration").get<osrm::json::Array>().values;
+//  auto distances = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("distance").get<osrm::json::Array>().values;
+//  auto geometries = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("geometry").get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
+//
+//    .at(0).get<osrm::json::Object>().values.at("maneuver").get<osrm::json::Object>().values.at("type").get<osrm::json::String>().value;
+
+//  assert(geometries.size() == durations.size() + 1);
+//
+  std::list<Routing::Segment> route;
+//  for (size_t i = 0; i < durations.size(); ++i)
+//  {
+//    Coordinate s_location{ osrm::util::FloatLongitude{geometries[i].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
+//    Coordinate e_location{
+//      osrm::util::FloatLongitude{geometries[i + 1].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i + 1].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
+//
+//    units::time::second_t duration = units::time::second_t(durations[i].get<osrm::json::Number>().value);
+//    units::length::meter_t distance = units::length::meter_t(distances[i].get<osrm::json::Number>().value);
+//
+//    route.emplace_back(Routing::Segment{ s_location, e_location,
+//           duration, distance, distance / duration, false });
+//  }
+
+  const auto& steps = legs.at(0).get<osrm::json::Object>().values.at("steps").get<osrm::json::Array>().values;
+
+  bool on_highway = false;
+
+  for (size_t i = 0; i < steps.size(); ++i) {
+    const auto& step = steps[i].get<osrm::json::Object>().values;
+    const auto& coordinates = step.at("geometry").get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
+    const auto& s_coordinate = coordinates.at(0).get<osrm::json::Array>().values;
+    const auto& e_coordinate = coordinates.at(1).get<osrm::json::Array>().values;
+    auto s_lon = s_coordinate.at(0).get<osrm::json::Number>().value, s_lat = s_coordinate.at(1).get<osrm::json::Number>().value;
+    auto e_lon = e_coordinate.at(0).get<osrm::json::Number>().value, e_lat = e_coordinate.at(1).get<osrm::json::Number>().value;
+    auto duration = units::time::second_t(step.at("duration").get<osrm::json::Number>().value);
+    auto distance = units::length::meter_t(step.at("distance").get<osrm::json::Number>().value);
+    const auto& maneuver_type = step.at("maneuver").get<osrm::json::Object>().values.at("type").get<osrm::json::String>().value;
+    if (maneuver_type == "on ramp")
+      on_highway = true;
+    route.emplace_back(Routing::Segment{ Coordinate{osrm::util::FloatLongitude{s_lon}, osrm::util::FloatLatitude{s_lat}}, Coordinate{osrm::util::FloatLongitude{e_lon}, osrm::util::FloatLatitude{e_lat}}, duration, distance, distance / duration, on_highway });
+    if (maneuver_type == "off ramp")
+      on_highway = false;
+  }
+
+  return route;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "routing.hpp"
+#include "osrm/osrm.hpp"
+#include "osrm/engine_config.hpp"
+
+// Routing on the road network through the OSRM library
+class OSRMRouting : public Routing {
+public:
+  OSRMRouting(osrm::EngineConfig config, std::size_t cache_size = RoutingCache::DEFAULT_SIZE) : Routing(cache_size), osrm{config} {}
+  
+  using Routing::compute_distances;
+  std::list<Segment> compute_route(const Coordinate& start_point, const Coordinate& end_point) override;
+  
+protected:
+  bool compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances) override;
+  osrm::OSRM osrm;
+};
@@ -3,17 +3,15 @@
 #include "data.hpp"
 #include "spdlog/spdlog.h"
 
-#include "osrm/json_container.hpp"
-
-#include "osrm/route_parameters.hpp"
-#include "osrm/table_parameters.hpp"
-#include "osrm/status.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cassert>
 
 const units::length::kilometer_t rad = units::length::kilometer_t(6371.0);
 
 units::length::kilometer_t Routing::haversine(const Coordinate& c1, const Coordinate& c2)
 {
-  float lat1, lat2, slat, slon;
+  double lat1, lat2, slat, slon;
   // distance between latitudes
   // and longitudes
   double dLat = (c2.lat.__value - c1.lat.__value) *
@@ -35,157 +33,196 @@ units::length::kilometer_t Routing::haversine(const Coordinate& c1, const Coordi
 
 std::vector<Routing::Segment> Routing::compute_distances(const std::list<Coordinate>& start_points, const std::list<Coordinate>& end_points)
 {
-  std::vector<Routing::Segment> results;
-      
-  osrm::TableParameters params;
-  size_t current = 0;
-  for (const auto & p : start_points)
-  {
-    params.coordinates.emplace_back(p);
-    params.sources.push_back(current++);
-  }
-  for (const auto & p : end_points)
+  std::vector<Coordinate> sources(start_points.begin(), start_points.end()), destinations(end_points.begin(), end_points.end());
+  if (sources.empty() || destinations.empty())
+    return {};
+  std::vector<Routing::Segment> results(sources.size() * destinations.size());
+  if (!cache_.enabled())
   {
-    params.coordinates.emplace_back(p);
-    params.destinations.push_back(current++);
+    std::vector<float> durations, distances;
+    if (!compute_table(sources, destinations, durations, distances))
+      return {};
+    for (size_t s = 0; s < sources.size(); s++)
+      for (size_t d = 0; d < destinations.size(); d++)
+        results[s * destinations.size() + d] = make_segment(sources[s], destinations[d], durations[s * destinations.size() + d], distances[s * destinations.size() + d]);
+    return results;
   }
-  params.annotations = osrm::TableParameters::AnnotationsType::All;
-  params.fallback_coordinate_type = osrm::TableParameters::FallbackCoordinateType::Snapped;
-  osrm::engine::api::ResultT result = osrm::json::Object();
-  const auto status = osrm.Table(params, result);
-  if (status != osrm::Status::Ok)
+  std::vector<bool> found(results.size(), false), missing_source(sources.size(), false), missing_destination(destinations.size(), false);
+  bool missing = false;
+  for (size_t s = 0; s < sources.size(); s++)
   {
-    spdlog::error("Error computing table routing ({}) {}", result.get<osrm::json::Object>().values["code"].get<osrm::json::String>().value, result.get<osrm::json::Object>().values["message"].get<osrm::json::String>().value);
-    return {};
+    for (size_t d = 0; d < destinations.size(); d++)
+    {
+      auto entry = cache_.get(sources[s], destinations[d]);
+      if (entry)
+      {
+        results[s * destinations.size() + d] = make_segment(sources[s], destinations[d], entry->duration, entry->distance);
+        found[s * destinations.size() + d] = true;
+      }
+      else
+      {
+        missing_source[s] = missing_destination[d] = true;
+        missing = true;
+      }
+    }
   }
+  if (!missing)
+    return results;
   
-  auto computed_durations = result.get<osrm::json::Object>().values.at("durations").get<osrm::json::Array>();
-  auto computed_distances = result.get<osrm::json::Object>().values.at("distances").get<osrm::json::Array>();
-  for (size_t s = 0; s < params.sources.size(); s++)
+  // compute only the sub-table of the sources and destinations that have at least a missing pair
+  std::vector<Coordinate> table_sources, table_destinations;
+  std::vector<size_t> source_index, destination_index;
+  for (size_t s = 0; s < sources.size(); s++)
+    if (missing_source[s])
+    {
+      table_sources.push_back(sources[s]);
+      source_index.push_back(s);
+    }
+  for (size_t d = 0; d < destinations.size(); d++)
+    if (missing_destination[d])
+    {
+      table_destinations.push_back(destinations[d]);
+      destination_index.push_back(d);
+    }
+  std::vector<float> durations, distances;
+  if (!compute_table(table_sources, table_destinations, durations, distances))
+    return {};
+  for (size_t s = 0; s < table_sources.size(); s++)
   {
-    auto computed_durations_s = computed_durations.values[s].get<osrm::json::Array>().values;
-    auto computed_distances_s = computed_distances.values[s].get<osrm::json::Array>().values;
-    for (size_t d = 0; d < params.destinations.size(); d++)
+    for (size_t d = 0; d < table_destinations.size(); d++)
     {
-      units::time::second_t duration = units::time::second_t(computed_durations_s[d].get<osrm::json::Number>().value);
-      units::length::meter_t distance = units::length::meter_t(computed_distances_s[d].get<osrm::json::Number>().value);
-      size_t s_index = params.sources[s], d_index = params.destinations[d];
-      results.emplace_back(Segment{ params.coordinates[s_index], params.coordinates[d_index], duration, distance, distance / duration, false });
+      size_t c = s * table_destinations.size() + d, r = source_index[s] * destinations.size() + destination_index[d];
+      cache_.put(table_sources[s], table_destinations[d], { durations[c], distances[c] });
+      if (!found[r])
+        results[r] = make_segment(table_sources[s], table_destinations[d], durations[c], distances[c]);
     }
   }
   
   return results;
 }
 
-//std::list<Routing::Segment> Routing::compute_route(const Coordinate& start_point, const Coordinate& end_point)
-//{
-//  osrm::RouteParameters params;
-//  params.steps = true;
-//  params.alternatives = false;
-//  params.annotations = true;
-//  params.annotations_type = osrm::RouteParameters::AnnotationsType::Duration | osrm::RouteParameters::AnnotationsType::Distance;
-//  params.overview = osrm::RouteParameters::OverviewType::Full;
-//  params.geometries = osrm::RouteParameters::GeometriesType::GeoJSON;
-//  params.coordinates.emplace_back(start_point);
-//  params.coordinates.emplace_back(end_point);
-//  osrm::engine::api::ResultT result = osrm::json::Object();
-//
-//  auto status = osrm.Route(params, result);
-//  if (status != osrm::Status::Ok)
-//  {
-//    spdlog::error("Error computing route ({}) {}",
-//                  result.get<osrm::json::Object>().values["code"].get<osrm::json::String>().value,
-//                  result.get<osrm::json::Object>().values["message"].get<osrm::json::String>().value);
-//    return {};
-//  }
-//  // get the steps of the route
-//  auto legs = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("legs").get<osrm::json::Array>().values;
-//  auto durations = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("duration").get<osrm::json::Array>().values;
-//  auto distances = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("distance").get<osrm::json::Array>().values;
-//  auto geometries = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("geometry").get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
-//  assert(geometries.size() == durations.size() + 1);
-//
-//  std::list<Routing::Segment> route;
-//  for (size_t i = 0; i < durations.size(); ++i) {
-//    Coordinate s_location{ osrm::util::FloatLongitude{geometries[i].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
-//    Coordinate e_location{
-//      osrm::util::FloatLongitude{geometries[i + 1].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i + 1].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
-//
-//    units::time::second_t duration = units::time::second_t(durations[i].get<osrm::json::Number>().value);
-//    units::length::meter_t distance = units::length::meter_t(distances[i].get<osrm::json::Number>().value);
-//
-//    route.emplace_back(Routing::Segment{ s_location, e_location,
-//           duration, distance, distance / duration, false });
-//  }
-//
-//  return route;
-//}
-
-std::list<Routing::Segment> Routing::compute_route(const Coordinate& start_point, const Coordinate& end_point)
-{
-  osrm::RouteParameters params;
-  params.steps = true;
-  params.alternatives = false;
-//  params.annotations = true;
-//  params.annotations_type = osrm::RouteParameters::AnnotationsType::Duration | osrm::RouteParameters::AnnotationsType::Distance;
-  params.overview = osrm::RouteParameters::OverviewType::False;
-  params.geometries = osrm::RouteParameters::GeometriesType::GeoJSON;
-  params.coordinates.emplace_back(start_point);
-  params.coordinates.emplace_back(end_point);
-  osrm::engine::api::ResultT result = osrm::json::Object();
-
-  auto status = osrm.Route(params, result);
-  if (status != osrm::Status::Ok)
-  {
-    spdlog::error("Error computing route ({}) {}",
-                  result.get<osrm::json::Object>().values["code"].get<osrm::json::String>().value,
-                  result.get<osrm::json::Object>().values["message"].get<osrm::json::String>().value);
-    return {};
+std::shared_ptr<const Route> Routing::route(const Coordinate& start_point, const Coordinate& end_point, bool cached)
+{
+  if (cached)
+  {
+    auto result = route_cache_.get(start_point, end_point);
+    if (result)
+      return result;
+  }
+  auto segments = compute_route(start_point, end_point);
+  std::vector<Coordinate> points;
+  std::vector<float> times;
+  points.reserve(segments.size() + 1);
+  times.reserve(segments.size() + 1);
+  points.push_back(start_point);
+  times.push_back(0.0f);
+  for (const auto& s : segments)
+  {
+    // each step start replaces the placeholder end point, the requested end points are kept at both ends
+    if (points.size() > 1)
+      points.back() = s.start_point;
+    points.push_back(end_point);
+    times.push_back(times.back() + float(units::time::second_t(s.duration).value()));
+  }
+  auto result = std::make_shared<const Route>(std::move(points), std::move(times));
+  // failed requests are not cached, they will be retried
+  if (cached && !segments.empty())
+    route_cache_.put(start_point, end_point, result);
+  return result;
+}
+
+void Routing::log_statistics() const
+{
+  const auto& stats = cache_.statistics();
+  spdlog::info("Routing cache: {} hits, {} misses, {} evictions, {} entries", stats.hits, stats.misses, stats.evictions, cache_.size());
+  const auto& route_stats = route_cache_.statistics();
+  spdlog::info("Route cache: {} hits, {} misses, {} evictions, {} entries", route_stats.hits, route_stats.misses, route_stats.evictions, route_cache_.size());
+}
+
+Route::Route(std::vector<Coordinate> points, std::vector<float> times) : points(std::move(points)), times(std::move(times))
+{
+  assert(this->points.size() == this->times.size());
+}
+
+Coordinate Route::position(double elapsed) const
+{
+  if (points.empty())
+    return Coordinate();
+  // the comparisons are made on the stored (float) times, so that the search below stays within the route
+  float t = float(elapsed);
+  if (t <= times.front())
+    return points.front();
+  if (t >= times.back())
+    return points.back();
+  // first step that ends after the elapsed time
+  std::size_t i = std::upper_bound(times.begin(), times.end(), t) - times.begin();
+  assert(i > 0 && i < times.size());
+  double span = times[i] - times[i - 1];
+  double f = span > 0.0 ? (t - times[i - 1]) / span : 1.0;
+  return interpolate(points[i - 1], points[i], f);
+}
+
+Coordinate Route::next_step(double elapsed) const
+{
+  if (points.empty())
+    return Coordinate();
+  // the last time is the end of the route, not the start of a step
+  auto it = std::upper_bound(times.begin(), times.end() - 1, float(elapsed));
+  return points[it - times.begin()];
+}
+
+Coordinate Route::interpolate(const Coordinate& from, const Coordinate& to, double f)
+{
+  return Coordinate{osrm::util::FloatLongitude{from.lon.__value + f * (to.lon.__value - from.lon.__value)}, osrm::util::FloatLatitude{from.lat.__value + f * (to.lat.__value - from.lat.__value)}};
+}
+
+std::shared_ptr<const Route> RouteCache::get(const Coordinate& start_point, const Coordinate& end_point)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(RoutingCache::key(start_point, end_point, resolution));
+  if (it == index.end())
+  {
+    stats.misses++;
+    return nullptr;
+  }
+  stats.hits++;
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->second;
+}
+
+void RouteCache::put(const Coordinate& start_point, const Coordinate& end_point, std::shared_ptr<const Route> route)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (max_size == 0)
+    return;
+  auto k = RoutingCache::key(start_point, end_point, resolution);
+  auto it = index.find(k);
+  if (it != index.end())
+  {
+    it->second->second = std::move(route);
+    entries.splice(entries.begin(), entries, it->second);
+    return;
+  }
+  entries.emplace_front(k, std::move(route));
+  index.emplace(k, entries.begin());
+  evict();
+}
+
+void RouteCache::set_max_size(std::size_t max_size)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->max_size = max_size;
+  evict();
+}
+
+void RouteCache::evict()
+{
+  while (entries.size() > max_size)
+  {
+    index.erase(entries.back().first);
+    entries.pop_back();
+    stats.evictions++;
   }
-  // get the steps of the route
-  auto legs = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("legs").get<osrm::json::Array>().values;
-//  auto durations = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("duration").get<osrm::json::Array>().values;
-//  auto distances = legs.at(0).get<osrm::json::Object>().values.at("annotation").get<osrm::json::Object>().values.at("distance").get<osrm::json::Array>().values;
-//  auto geometries = result.get<osrm::json::Object>().values.at("routes").get<osrm::json::Array>().values.at(0).get<osrm::json::Object>().values.at("geometry").get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
-//
-//    .at(0).get<osrm::json::Object>().values.at("maneuver").get<osrm::json::Object>().values.at("type").get<osrm::json::String>().value;
-
-//  assert(geometries.size() == durations.size() + 1);
-//
-  std::list<Routing::Segment> route;
-//  for (size_t i = 0; i < durations.size(); ++i)
-//  {
-//    Coordinate s_location{ osrm::util::FloatLongitude{geometries[i].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
-//    Coordinate e_location{
-//      osrm::util::FloatLongitude{geometries[i + 1].get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value}, osrm::util::FloatLatitude{geometries[i + 1].get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value }};
-//
-//    units::time::second_t duration = units::time::second_t(durations[i].get<osrm::json::Number>().value);
-//    units::length::meter_t distance = units::length::meter_t(distances[i].get<osrm::json::Number>().value);
-//
-//    route.emplace_back(Routing::Segment{ s_location, e_location,
-//           duration, distance, distance / duration, false });
-//  }
-
-  auto steps = legs.at(0).get<osrm::json::Object>().values.at("steps").get<osrm::json::Array>().values;
-
-  bool on_highway = false;
-
-  for (size_t i = 0; i < steps.size(); ++i) {
-    auto step = steps[i].get<osrm::json::Object>().values;
-    auto coordinates = step.at("geometry").get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
-    auto s_lon = coordinates.at(0).get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value, s_lat = coordinates.at(0).get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value;
-    auto e_lon = coordinates.at(1).get<osrm::json::Array>().values.at(0).get<osrm::json::Number>().value, e_lat = coordinates.at(1).get<osrm::json::Array>().values.at(1).get<osrm::json::Number>().value;
-    auto duration = units::time::second_t(step.at("duration").get<osrm::json::Number>().value);
-    auto distance = units::length::meter_t(step.at("distance").get<osrm::json::Number>().value);
-    auto maneuver_type = step.at("maneuver").get<osrm::json::Object>().values.at("type").get<osrm::json::String>().value;
-    if (maneuver_type == "on ramp")
-      on_highway = true;
-    route.emplace_back(Routing::Segment{ Coordinate{osrm::util::FloatLongitude{s_lon}, osrm::util::FloatLatitude{s_lat}}, Coordinate{osrm::util::FloatLongitude{e_lon}, osrm::util::FloatLatitude{e_lat}}, duration, distance, distance / duration, on_highway });
-    if (maneuver_type == "off ramp")
-      on_highway = false;
-  }
-
-  return route;
 }
 
 std::istream &operator>>(std::istream &is, Coordinate &c)
@@ -196,3 +233,139 @@ std::istream &operator>>(std::istream &is, Coordinate &c)
   c = Coordinate{osrm::util::FloatLongitude{lon}, osrm::util::FloatLatitude{lat}};
   return is;
 }
+
+RoutingCache::Key RoutingCache::key(const Coordinate& start_point, const Coordinate& end_point, double resolution)
+{
+  return Key{
+    std::int32_t(std::lround(start_point.lon.__value / resolution)), std::int32_t(std::lround(start_point.lat.__value / resolution)),
+    std::int32_t(std::lround(end_point.lon.__value / resolution)), std::int32_t(std::lround(end_point.lat.__value / resolution))
+  };
+}
+
+std::size_t RoutingCache::KeyHash::operator()(const Key& k) const noexcept
+{
+  std::size_t h = std::hash<std::int32_t>{}(k.s_lon);
+  for (auto v : { k.s_lat, k.e_lon, k.e_lat })
+    h ^= std::hash<std::int32_t>{}(v) + 0x9e3779b9 + (h << 6) + (h >> 2);
+  return h;
+}
+
+std::optional<RoutingCache::Entry> RoutingCache::get(const Coordinate& start_point, const Coordinate& end_point)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(key(start_point, end_point));
+  if (it == index.end())
+  {
+    stats.misses++;
+    return {};
+  }
+  stats.hits++;
+  // move the entry in front of the recency list
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->second;
+}
+
+void RoutingCache::put(const Coordinate& start_point, const Coordinate& end_point, const Entry& entry)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  insert(key(start_point, end_point), entry);
+}
+
+void RoutingCache::insert(const Key& k, const Entry& entry)
+{
+  if (max_size == 0)
+    return;
+  auto it = index.find(k);
+  if (it != index.end())
+  {
+    it->second->second = entry;
+    entries.splice(entries.begin(), entries, it->second);
+    return;
+  }
+  entries.emplace_front(k, entry);
+  index.emplace(k, entries.begin());
+  evict();
+}
+
+void RoutingCache::set_max_size(std::size_t max_size)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->max_size = max_size;
+  evict();
+}
+
+void RoutingCache::evict()
+{
+  while (entries.size() > max_size)
+  {
+    index.erase(entries.back().first);
+    entries.pop_back();
+    stats.evictions++;
+  }
+}
+
+static const char CACHE_MAGIC[8] = { 'E', 'M', 'S', 'R', 'C', 'A', 'C', '1' };
+
+bool RoutingCache::load(const std::string& filename)
+{
+  std::ifstream is(filename, std::ios::binary);
+  if (!is)
+    return false;
+  char magic[sizeof(CACHE_MAGIC)];
+  double file_resolution;
+  std::uint64_t count;
+  is.read(magic, sizeof(magic));
+  is.read(reinterpret_cast<char*>(&file_resolution), sizeof(file_resolution));
+  is.read(reinterpret_cast<char*>(&count), sizeof(count));
+  // the number of entries must match the rest of the file, before anything is allocated
+  auto header_end = is.tellg();
+  is.seekg(0, std::ios::end);
+  auto remaining = std::uint64_t(is.tellg() - header_end);
+  is.seekg(header_end);
+  if (!is || !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC) || count > remaining / (sizeof(Key) + sizeof(Entry)))
+  {
+    spdlog::error("Routing cache file {} is not valid", filename);
+    return false;
+  }
+  if (file_resolution != resolution)
+  {
+    spdlog::error("Routing cache file {} has a different resolution ({} instead of {})", filename, file_resolution, resolution);
+    return false;
+  }
+  // entries are stored from the most recent, insert them backwards to preserve recency
+  std::vector<std::pair<Key, Entry>> read_entries(count);
+  for (auto& p : read_entries)
+  {
+    is.read(reinterpret_cast<char*>(&p.first), sizeof(Key));
+    is.read(reinterpret_cast<char*>(&p.second), sizeof(Entry));
+  }
+  if (!is)
+  {
+    spdlog::error("Routing cache file {} is truncated", filename);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto it = read_entries.rbegin(); it != read_entries.rend(); ++it)
+    insert(it->first, it->second);
+  return true;
+}
+
+void RoutingCache::save(const std::string& filename) const
+{
+  std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+  if (!os)
+  {
+    spdlog::error("Could not write routing cache file {}", filename);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  std::uint64_t count = entries.size();
+  os.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  os.write(reinterpret_cast<const char*>(&resolution), sizeof(resolution));
+  os.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (const auto& p : entries)
+  {
+    os.write(reinterpret_cast<const char*>(&p.first), sizeof(Key));
+    os.write(reinterpret_cast<const char*>(&p.second), sizeof(Entry));
+  }
+}
@@ -1,10 +1,15 @@
 #pragma once
 
-#include "osrm/osrm.hpp"
-#include "osrm/engine_config.hpp"
 #include "osrm/coordinate.hpp"
 #include <list>
 #include <vector>
+#include <unordered_map>
+#include <optional>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <istream>
 #include "units.h"
 
 typedef osrm::util::FloatCoordinate Coordinate;
@@ -20,7 +25,124 @@ struct std::hash<Coordinate>
   }
 };
 
+// Cache of travel times and distances between pairs of points. Coordinates are
+// quantized to a fixed resolution (by default 1e-5 degrees, about one meter), so
+// that requests between the same places share the same entry. When the cache is
+// full the least recently used pair is evicted. The cache can be shared among
+// threads, each operation holds a lock.
+class RoutingCache {
+public:
+  struct Entry {
+    // duration is expressed in seconds
+    float duration;
+    // distance is expressed in meters
+    float distance;
+  };
+  struct Statistics {
+    std::size_t hits = 0, misses = 0, evictions = 0;
+  };
+  struct Key {
+    std::int32_t s_lon, s_lat, e_lon, e_lat;
+    bool operator==(const Key& other) const = default;
+  };
+  struct KeyHash {
+    std::size_t operator()(const Key& k) const noexcept;
+  };
+  static constexpr std::size_t DEFAULT_SIZE = 1 << 20;
+  static constexpr double DEFAULT_RESOLUTION = 1e-5;
+  
+  static Key key(const Coordinate& start_point, const Coordinate& end_point, double resolution);
+  
+  RoutingCache(std::size_t max_size = DEFAULT_SIZE, double resolution = DEFAULT_RESOLUTION) : max_size(max_size), resolution(resolution) {}
+  
+  std::optional<Entry> get(const Coordinate& start_point, const Coordinate& end_point);
+  void put(const Coordinate& start_point, const Coordinate& end_point, const Entry& entry);
+  void set_max_size(std::size_t max_size);
+  inline std::size_t size() const { std::lock_guard<std::mutex> lock(mutex); return index.size(); }
+  inline bool enabled() const { return max_size > 0; }
+  inline const Statistics& statistics() const { return stats; }
+  
+  // the cache file is a plain binary dump of the quantized keys and of the entries
+  bool load(const std::string& filename);
+  void save(const std::string& filename) const;
+protected:
+  inline Key key(const Coordinate& start_point, const Coordinate& end_point) const { return key(start_point, end_point, resolution); }
+  // the following methods expect the lock to be held
+  void insert(const Key& k, const Entry& entry);
+  void evict();
+  
+  std::size_t max_size;
+  double resolution;
+  Statistics stats;
+  // entries are kept in recency order (most recent first)
+  std::list<std::pair<Key, Entry>> entries;
+  std::unordered_map<Key, std::list<std::pair<Key, Entry>>::iterator, KeyHash> index;
+  mutable std::mutex mutex;
+};
+
+// Geometry of a route, stored once per travel: the points where the steps
+// start (plus the final end point) and the cumulative time at which each of
+// them is reached. The position at a given elapsed time is found by binary
+// search and interpolated linearly within the step.
+class Route {
+public:
+  Route() = default;
+  Route(std::vector<Coordinate> points, std::vector<float> times);
+  // elapsed time is expressed in seconds from the start of the route
+  Coordinate position(double elapsed) const;
+  // start of the first step not begun yet at the elapsed time (the end point if every step has begun),
+  // i.e., the position reported by walking the steps, without interpolation
+  Coordinate next_step(double elapsed) const;
+  // duration is expressed in seconds
+  inline double duration() const { return times.empty() ? 0.0 : times.back(); }
+  inline bool empty() const { return points.empty(); }
+  inline std::size_t steps() const { return points.empty() ? 0 : points.size() - 1; }
+  // point at the given fraction of the straight line between two points
+  static Coordinate interpolate(const Coordinate& from, const Coordinate& to, double f);
+protected:
+  std::vector<Coordinate> points;
+  // cumulative times are expressed in seconds
+  std::vector<float> times;
+};
+
+// Cache of the routes between recurring pairs of points (e.g., from a base to a
+// hospital), with the same quantization and eviction policy of RoutingCache.
+// Routes are immutable and shared with the ambulances travelling along them.
+class RouteCache {
+public:
+  struct Statistics {
+    std::size_t hits = 0, misses = 0, evictions = 0;
+  };
+  static constexpr std::size_t DEFAULT_SIZE = 1 << 14;
+  
+  RouteCache(std::size_t max_size = DEFAULT_SIZE, double resolution = RoutingCache::DEFAULT_RESOLUTION) : max_size(max_size), resolution(resolution) {}
+  
+  std::shared_ptr<const Route> get(const Coordinate& start_point, const Coordinate& end_point);
+  void put(const Coordinate& start_point, const Coordinate& end_point, std::shared_ptr<const Route> route);
+  void set_max_size(std::size_t max_size);
+  inline std::size_t size() const { std::lock_guard<std::mutex> lock(mutex); return index.size(); }
+  inline bool enabled() const { return max_size > 0; }
+  inline const Statistics& statistics() const { return stats; }
+protected:
+  // expects the lock to be held
+  void evict();
+  
+  std::size_t max_size;
+  double resolution;
+  Statistics stats;
+  // entries are kept in recency order (most recent first)
+  std::list<std::pair<RoutingCache::Key, std::shared_ptr<const Route>>> entries;
+  std::unordered_map<RoutingCache::Key, std::list<std::pair<RoutingCache::Key, std::shared_ptr<const Route>>>::iterator, RoutingCache::KeyHash> index;
+  mutable std::mutex mutex;
+};
+
+class TravelMatrix;
+
+// Routing backend interface. Concrete backends only have to provide the
+// many-to-many table computation and the route between two points, the
+// results of compute_distances are cached by this class.
 class Routing {
+  friend class TravelMatrix;
 public:
   struct Segment {
     Coordinate start_point, end_point;
@@ -33,11 +155,12 @@ public:
     bool on_highway;
   };
   
-  Routing(osrm::EngineConfig config) : osrm{config} {}
+  Routing(std::size_t cache_size = RoutingCache::DEFAULT_SIZE) : cache_(cache_size) {}
+  virtual ~Routing() = default;
   
   static units::length::kilometer_t haversine(const Coordinate& c1, const Coordinate& c2);
   
-  std::vector<Segment> compute_distances(const std::list<Coordinate>& start_points, const std::list<Coordinate>& end_points);
+  virtual std::vector<Segment> compute_distances(const std::list<Coordinate>& start_points, const std::list<Coordinate>& end_points);
   
   inline std::vector<Segment> compute_distances(const Coordinate& start_point, const std::list<Coordinate>& end_points)
   {
@@ -54,12 +177,27 @@ public:
     return compute_distances(std::list<Coordinate>({ start_point }), std::list<Coordinate>({ end_point })).front();
   }
   
-  std::list<Segment> compute_route(const Coordinate& start_point, const Coordinate& end_point);
+  virtual std::list<Segment> compute_route(const Coordinate& start_point, const Coordinate& end_point) = 0;
+  
+  // route geometry between two points, computed once and (unless disabled) shared through the route cache
+  std::shared_ptr<const Route> route(const Coordinate& start_point, const Coordinate& end_point, bool cached = true);
+  
+  virtual RoutingCache& cache() { return cache_; }
+  inline RouteCache& route_cache() { return route_cache_; }
+  virtual void log_statistics() const;
   
 protected:
-  osrm::OSRM osrm;
-  // TODO: possibly cache results to avoid recomputing
-  // std::map<std::pair<std::size_t, std::size_t>, Result> cached_;
+  // actual (uncached) many-to-many computation, durations (in seconds) and
+  // distances (in meters) are stored in row-major order
+  virtual bool compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances) = 0;
+  static inline Segment make_segment(const Coordinate& start_point, const Coordinate& end_point, float duration, float distance)
+  {
+    units::time::second_t d = units::time::second_t(duration);
+    units::length::meter_t l = units::length::meter_t(distance);
+    return Segment{ start_point, end_point, d, l, l / d, false };
+  }
+  RoutingCache cache_;
+  RouteCache route_cache_;
 };
 
 std::istream &operator>>(std::istream &is, Coordinate &c);
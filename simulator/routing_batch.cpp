@@ -0,0 +1,141 @@
+#include "routing_batch.hpp"
+#include <algorithm>
+
+simcpp20::event<Time> RoutingBatch::request(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations)
+{
+  std::vector<std::size_t> requested;
+  for (const auto& s : sources)
+  {
+    auto [it, added] = source_index.emplace(point_key(s), this->sources.size());
+    if (added)
+      this->sources.push_back(s);
+    requested.push_back(it->second);
+  }
+  for (const auto& d : destinations)
+  {
+    auto [it, added] = destination_index.emplace(point_key(d), this->destinations.size());
+    if (added)
+    {
+      this->destinations.push_back(d);
+      destination_sources.emplace_back();
+    }
+    auto& s = destination_sources[it->second];
+    s.insert(s.end(), requested.begin(), requested.end());
+  }
+  stats.requests++;
+  auto ev = resolved_;
+  if (!pending)
+  {
+    pending = true;
+    resolve();
+  }
+  return ev;
+}
+
+simcpp20::event<Time> RoutingBatch::resolve()
+{
+  // the processes already scheduled at this time add their requests before the batch is resolved
+  co_await sim.timeout(0);
+  auto ev = resolved_;
+  resolved_ = sim.event<Time>();
+  pending = false;
+  auto batch_sources = std::move(sources);
+  auto batch_destinations = std::move(destinations);
+  auto requested = std::move(destination_sources);
+  sources.clear();
+  destinations.clear();
+  destination_sources.clear();
+  source_index.clear();
+  destination_index.clear();
+  if (resolved_time != sim.now())
+  {
+    results.clear();
+    resolved_time = sim.now();
+  }
+  // the destinations are packed in order into tables whose sources are those requested by any of them
+  std::vector<bool> in_table(batch_sources.size(), false);
+  std::vector<std::size_t> table_sources, table_destinations;
+  std::size_t table_requested = 0;
+  auto compute_table = [&]() {
+    if (table_destinations.empty())
+      return;
+    std::list<Coordinate> s, d;
+    for (auto i : table_sources)
+    {
+      s.push_back(batch_sources[i]);
+      in_table[i] = false;
+    }
+    for (auto j : table_destinations)
+      d.push_back(batch_destinations[j]);
+    auto segments = routing.compute_distances(s, d);
+    // a failed table leaves the pairs to the direct computation
+    if (segments.size() == s.size() * d.size())
+    {
+      for (const auto& segment : segments)
+        results.emplace(RoutingCache::key(segment.start_point, segment.end_point, RoutingCache::DEFAULT_RESOLUTION), segment);
+      stats.batches++;
+      stats.pairs += segments.size();
+    }
+    table_sources.clear();
+    table_destinations.clear();
+    table_requested = 0;
+  };
+  for (std::size_t j = 0; j < batch_destinations.size(); j++)
+  {
+    auto& r = requested[j];
+    if (r.empty())
+      continue;
+    std::sort(r.begin(), r.end());
+    r.erase(std::unique(r.begin(), r.end()), r.end());
+    std::size_t new_sources = std::count_if(r.begin(), r.end(), [&in_table](std::size_t i) { return !in_table[i]; });
+    std::size_t size = (table_sources.size() + new_sources) * (table_destinations.size() + 1);
+    if (!table_destinations.empty() && size > SMALL_TABLE && 2 * (table_requested + r.size()) < size)
+      compute_table();
+    for (auto i : r)
+      if (!in_table[i])
+      {
+        in_table[i] = true;
+        table_sources.push_back(i);
+      }
+    table_destinations.push_back(j);
+    table_requested += r.size();
+  }
+  compute_table();
+  ev.trigger();
+}
+
+std::vector<Routing::Segment> RoutingBatch::lookup(const std::list<Coordinate>& sources, const std::list<Coordinate>& destinations)
+{
+  if (resolved_time != sim.now())
+  {
+    stats.misses += sources.size() * destinations.size();
+    return routing.compute_distances(sources, destinations);
+  }
+  std::vector<Routing::Segment> segments;
+  segments.reserve(sources.size() * destinations.size());
+  std::list<Coordinate> missing;
+  std::vector<std::size_t> missing_index;
+  for (const auto& s : sources)
+    for (const auto& d : destinations)
+    {
+      auto it = results.find(RoutingCache::key(s, d, RoutingCache::DEFAULT_RESOLUTION));
+      if (it == results.end())
+      {
+        // the single point is shared by all the pairs, the other one is missing
+        missing.push_back(sources.size() == 1 ? d : s);
+        missing_index.push_back(segments.size());
+        segments.push_back(Routing::Segment{ s, d });
+      }
+      else
+        segments.push_back(it->second);
+    }
+  if (missing.empty())
+    return segments;
+  stats.misses += missing.size();
+  auto computed = sources.size() == 1 ? routing.compute_distances(sources, missing) : routing.compute_distances(missing, destinations);
+  if (computed.size() != missing.size())
+    return {};
+  for (std::size_t i = 0; i < computed.size(); i++)
+    segments[missing_index[i]] = computed[i];
+  return segments;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "data.hpp"
+#include "routing.hpp"
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+// Routing queries raised by the dispatcher at the same simulated time. The
+// processes add their pairs of points and wait; once all the processes resumed
+// at that time have run, the batch is resolved with a few many-to-many table
+// requests. The requested pairs are grouped by destination, and the destinations
+// are packed into a table as long as most of its pairs have been requested (or
+// the table is small), so that the pairs nobody reads are bounded. The results
+// are then read by the dispatching policy during the same time; the pairs that
+// were not requested in advance are computed directly.
+class RoutingBatch {
+public:
+  struct Statistics {
+    // tables computed, requests and pairs collected in them, pairs computed outside of a batch
+    std::size_t batches = 0, requests = 0, pairs = 0, misses = 0;
+  };
+  // tables up to this number of pairs are computed whole, larger ones only if at least half of their pairs are requested
+  static constexpr std::size_t SMALL_TABLE = 64;
+  RoutingBatch(simcpp20::simulation<Time>& sim, Routing& routing) : sim(sim), routing(routing), pending(false), resolved_time(-1), resolved_(sim.event<Time>()) {}
+  // adds the pairs from the sources to the destinations, the event is triggered when they have been computed
+  simcpp20::event<Time> request(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations);
+  inline simcpp20::event<Time> request(const std::vector<Coordinate>& sources, const Coordinate& destination) { return request(sources, std::vector<Coordinate>{ destination }); }
+  // segments from the sources to the destination, as Routing::compute_distances
+  inline std::vector<Routing::Segment> compute_distances(const std::list<Coordinate>& sources, const Coordinate& destination) { return lookup(sources, { destination }); }
+  // segments from the source to the destinations, as Routing::compute_distances
+  inline std::vector<Routing::Segment> compute_distances(const Coordinate& source, const std::list<Coordinate>& destinations) { return lookup({ source }, destinations); }
+  inline const Statistics& statistics() const { return stats; }
+protected:
+  simcpp20::event<Time> resolve();
+  // either the sources or the destinations are a single point
+  std::vector<Routing::Segment> lookup(const std::list<Coordinate>& sources, const std::list<Coordinate>& destinations);
+  static inline std::uint64_t point_key(const Coordinate& c)
+  {
+    auto k = RoutingCache::key(c, c, RoutingCache::DEFAULT_RESOLUTION);
+    return (std::uint64_t(std::uint32_t(k.s_lon)) << 32) | std::uint32_t(k.s_lat);
+  }
+  simcpp20::simulation<Time>& sim;
+  Routing& routing;
+  bool pending;
+  // points of the batch being collected (each point once), and the sources requested for each destination
+  std::vector<Coordinate> sources, destinations;
+  std::unordered_map<std::uint64_t, std::size_t> source_index, destination_index;
+  std::vector<std::vector<std::size_t>> destination_sources;
+  // results of the batches resolved at the current time
+  Time resolved_time;
+  std::unordered_map<RoutingCache::Key, Routing::Segment, RoutingCache::KeyHash> results;
+  simcpp20::event<Time> resolved_;
+  Statistics stats;
+};
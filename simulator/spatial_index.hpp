@@ -0,0 +1,106 @@
+#pragma once
+
+#include "routing.hpp"
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Uniform lat/lon grid of items, each item covers the cells of a bounding box
+// (a single cell for a point). Radius queries only visit the cells overlapping
+// the bounding box of the circle and report each item once; the exact distance
+// check is left to the caller.
+template <typename T>
+class SpatialGrid {
+public:
+  // cell size is expressed in km
+  static constexpr double DEFAULT_CELL_SIZE = 5.0;
+
+  SpatialGrid(double cell_size = DEFAULT_CELL_SIZE) : lat_step(cell_size / KM_PER_DEGREE), lon_step(0.0) {}
+
+  void insert(const T& item, const Coordinate& c)
+  {
+    insert(item, c, c, units::length::kilometer_t(0.0));
+  }
+
+  // the item covers the bounding box of the two points, enlarged by margin
+  void insert(const T& item, const Coordinate& c1, const Coordinate& c2, units::length::kilometer_t margin)
+  {
+    remove(item);
+    double lat_margin = margin.value() / KM_PER_DEGREE;
+    double min_lat = std::min(c1.lat.__value, c2.lat.__value) - lat_margin, max_lat = std::max(c1.lat.__value, c2.lat.__value) + lat_margin;
+    if (lon_step == 0.0) // the longitude step is fixed at the first insertion, so that cells are roughly square
+      lon_step = lat_step / std::cos(c1.lat.__value * M_PI / 180.0);
+    double lon_margin = lat_margin / std::cos(std::min(89.0, std::max(std::abs(min_lat), std::abs(max_lat))) * M_PI / 180.0);
+    Box b{ row(min_lat), row(max_lat), column(std::min(c1.lon.__value, c2.lon.__value) - lon_margin), column(std::max(c1.lon.__value, c2.lon.__value) + lon_margin) };
+    for (auto i = b.min_row; i <= b.max_row; i++)
+      for (auto j = b.min_column; j <= b.max_column; j++)
+        cells[cell(i, j)].emplace_back(item, b);
+    boxes.emplace(item, b);
+  }
+
+  void remove(const T& item)
+  {
+    auto it = boxes.find(item);
+    if (it == boxes.end())
+      return;
+    const Box& b = it->second;
+    for (auto i = b.min_row; i <= b.max_row; i++)
+      for (auto j = b.min_column; j <= b.max_column; j++)
+      {
+        auto c = cells.find(cell(i, j));
+        auto& items = c->second;
+        items.erase(std::find_if(items.begin(), items.end(), [&item](const auto& p) { return p.first == item; }));
+        if (items.empty())
+          cells.erase(c);
+      }
+    boxes.erase(it);
+  }
+
+  inline bool contains(const T& item) const { return boxes.count(item) > 0; }
+  inline std::size_t size() const { return boxes.size(); }
+
+  // calls f(item) for each item whose box overlaps the bounding box of the circle
+  template <typename F>
+  void query(const Coordinate& center, units::length::kilometer_t radius, F f) const
+  {
+    if (boxes.empty())
+      return;
+    Box q = bounding_box(center, radius);
+    for (auto i = q.min_row; i <= q.max_row; i++)
+      for (auto j = q.min_column; j <= q.max_column; j++)
+      {
+        auto c = cells.find(cell(i, j));
+        if (c == cells.end())
+          continue;
+        for (const auto& [item, b] : c->second)
+        {
+          // an item spanning several cells is reported only in the first cell shared with the query
+          if (i == std::max(b.min_row, q.min_row) && j == std::max(b.min_column, q.min_column))
+            f(item);
+        }
+      }
+  }
+
+protected:
+  // length of one degree of latitude (in km) on the sphere used by Routing::haversine
+  static constexpr double KM_PER_DEGREE = 2.0 * M_PI * 6371.0 / 360.0;
+  struct Box {
+    std::int64_t min_row, max_row, min_column, max_column;
+  };
+  inline std::int64_t row(double lat) const { return std::int64_t(std::floor(lat / lat_step)); }
+  inline std::int64_t column(double lon) const { return std::int64_t(std::floor(lon / lon_step)); }
+  static inline std::int64_t cell(std::int64_t i, std::int64_t j) { return (i << 32) ^ (j & 0xffffffff); }
+  Box bounding_box(const Coordinate& center, units::length::kilometer_t radius) const
+  {
+    double lat_radius = radius.value() / KM_PER_DEGREE;
+    double max_abs_lat = std::min(89.0, std::abs(center.lat.__value) + lat_radius);
+    double lon_radius = lat_radius / std::cos(max_abs_lat * M_PI / 180.0);
+    return Box{ row(center.lat.__value - lat_radius), row(center.lat.__value + lat_radius), column(center.lon.__value - lon_radius), column(center.lon.__value + lon_radius) };
+  }
+
+  double lat_step, lon_step;
+  std::unordered_map<std::int64_t, std::vector<std::pair<T, Box>>> cells;
+  std::unordered_map<T, Box> boxes;
+};
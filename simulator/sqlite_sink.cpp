@@ -0,0 +1,149 @@
+#include "sqlite_sink.hpp"
+#include "helpers.hpp"
+
+SQLiteSink::SQLiteSink(const std::string& db_filename, const Options& options, const SimulationContext& context, bool compact) : DataSink(context, compact) {
+  db = std::make_unique<SQLite::Database>(db_filename, SQLite::OPEN_READWRITE|SQLite::OPEN_CREATE);
+  if (options.wal)
+    db->exec("PRAGMA journal_mode = WAL");
+  if (!options.synchronous)
+    db->exec("PRAGMA synchronous = OFF");
+  SQLite::Transaction transaction(*db);
+  db->exec("DROP TABLE IF EXISTS rescue");
+  db->exec("DROP TABLE IF EXISTS ambulance_event");
+  for (auto table : { "simulation", "emergency_code", "ambulance_code", "hospital_code", "triage_code", "state_code" })
+    db->exec(std::string("DROP TABLE IF EXISTS ") + table);
+  if (compact)
+    create_compact_tables();
+  else
+    create_tables();
+  transaction.commit();
+  insert_rescue = std::make_unique<SQLite::Statement>(*db, "INSERT INTO rescue VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+  insert_ambulance_event = std::make_unique<SQLite::Statement>(*db, "INSERT INTO ambulance_event VALUES (?, ?, ?, ?)");
+  insert_ambulance_state = std::make_unique<SQLite::Statement>(*db, "INSERT INTO ambulance_event VALUES (?, NULL, ?, ?)");
+  if (compact)
+    for (auto entity : { EMERGENCY, AMBULANCE, HOSPITAL })
+      insert_code[entity] = std::make_unique<SQLite::Statement>(*db, std::string("INSERT INTO ") + code_table(entity) + " VALUES (?, ?)");
+}
+
+void SQLiteSink::create_tables() {
+  db->exec("CREATE TABLE IF NOT EXISTS rescue (emergency VARCHAR(255) NOT NULL, ambulance VARCHAR(255) NOT NULL, hospital VARCHAR(32), triage VARCHAR(10) NOT NULL, call DATETIME NOT NULL, start DATETIME NOT NULL, at_emergency DATETIME NOT NULL, at_hospital DATETIME, PRIMARY KEY (emergency, ambulance))");
+  db->exec("CREATE TABLE IF NOT EXISTS ambulance_event (ambulance VARCHAR(255) NOT NULL, emergency VARCHAR(255), state VARCHAR(255) NOT NULL, time DATETIME NOT NULL)");
+}
+
+void SQLiteSink::create_compact_tables() {
+  db->exec("CREATE TABLE IF NOT EXISTS rescue (emergency INTEGER NOT NULL, ambulance INTEGER NOT NULL, hospital INTEGER, triage INTEGER NOT NULL, call INTEGER NOT NULL, start INTEGER NOT NULL, at_emergency INTEGER NOT NULL, at_hospital INTEGER, PRIMARY KEY (emergency, ambulance))");
+  db->exec("CREATE TABLE IF NOT EXISTS ambulance_event (ambulance INTEGER NOT NULL, emergency INTEGER, state INTEGER NOT NULL, time INTEGER NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS simulation (epoch INTEGER NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS emergency_code (code INTEGER PRIMARY KEY, id VARCHAR(255) NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS ambulance_code (code INTEGER PRIMARY KEY, id VARCHAR(255) NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS hospital_code (code INTEGER PRIMARY KEY, id VARCHAR(32) NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS triage_code (code INTEGER PRIMARY KEY, name VARCHAR(10) NOT NULL)");
+  db->exec("CREATE TABLE IF NOT EXISTS state_code (code INTEGER PRIMARY KEY, name VARCHAR(255) NOT NULL)");
+  // times are offsets in seconds from this (UNIX) epoch
+  SQLite::Statement simulation(*db, "INSERT INTO simulation VALUES (?)");
+  simulation.bind(1, epoch());
+  simulation.exec();
+  SQLite::Statement triage(*db, "INSERT INTO triage_code VALUES (?, ?)");
+  for (int c = Emergency::RED; c <= Emergency::BLACK; c++) {
+    triage.bind(1, c);
+    triage.bind(2, std::to_string(Emergency::Code(c)));
+    triage.exec();
+    triage.reset();
+  }
+  SQLite::Statement state(*db, "INSERT INTO state_code VALUES (?, ?)");
+  for (int s = Ambulance::UNAVAILABLE; s <= Ambulance::PREEMPTED; s++) {
+    state.bind(1, s);
+    state.bind(2, std::to_string(Ambulance::State(s)));
+    state.exec();
+    state.reset();
+  }
+}
+
+void SQLiteSink::write_code(Entity entity, std::int32_t code, const std::string& id) {
+  auto& query = *insert_code[entity];
+  query.bind(1, code);
+  query.bind(2, id);
+  query.exec();
+  query.reset();
+}
+
+void SQLiteSink::bind_time(SQLite::Statement& query, int column, Time t) {
+  if (compact)
+    query.bind(column, std::int64_t(t));
+  else
+    query.bind(column, std::to_string(context.conf.start_time, t));
+}
+
+void SQLiteSink::bind_entity(SQLite::Statement& query, int column, Entity entity, std::int32_t index) {
+  if (index < 0)
+    query.bind(column, nullptr);
+  else if (compact)
+    query.bind(column, code(entity, index));
+  else
+    query.bind(column, id(entity, index));
+}
+
+void SQLiteSink::write(const DataRecord& r) {
+  SQLite::Statement* query = nullptr;
+  try {
+    if (!batch)
+      batch = std::make_unique<SQLite::Transaction>(*db);
+    switch (r.kind) {
+      case DataRecord::RESCUE:
+        query = insert_rescue.get();
+        bind_entity(*query, 1, EMERGENCY, r.emergency);
+        bind_entity(*query, 2, AMBULANCE, r.ambulance);
+        bind_entity(*query, 3, HOSPITAL, r.hospital);
+        if (compact)
+          query->bind(4, int(r.state));
+        else
+          query->bind(4, std::to_string(Emergency::Code(r.state)));
+        bind_time(*query, 5, r.times[0]);
+        bind_time(*query, 6, r.times[1]);
+        bind_time(*query, 7, r.times[2]);
+        if (r.hospital >= 0)
+          bind_time(*query, 8, r.times[3]);
+        else
+          query->bind(8, nullptr);
+        break;
+      case DataRecord::AMBULANCE_EVENT:
+        query = insert_ambulance_event.get();
+        bind_entity(*query, 1, AMBULANCE, r.ambulance);
+        bind_entity(*query, 2, EMERGENCY, r.emergency);
+        if (compact)
+          query->bind(3, int(r.state));
+        else
+          query->bind(3, std::to_string(Ambulance::State(r.state)));
+        bind_time(*query, 4, r.times[0]);
+        break;
+      case DataRecord::AMBULANCE_STATE:
+        query = insert_ambulance_state.get();
+        bind_entity(*query, 1, AMBULANCE, r.ambulance);
+        if (compact)
+          query->bind(2, int(r.state));
+        else
+          query->bind(2, std::to_string(Ambulance::State(r.state)));
+        bind_time(*query, 3, r.times[0]);
+        break;
+    }
+    query->exec();
+    query->reset();
+  } catch (std::exception& ex) {
+    if (query)
+      query->tryReset();
+    std::cerr << "ERROR in DB logging (" << (r.kind == DataRecord::RESCUE ? "rescue" : "ambulance") << ") " << ex.what() << std::endl;
+    if (r.emergency >= 0)
+      std::cerr << id(EMERGENCY, r.emergency) << "/";
+    std::cerr << id(AMBULANCE, r.ambulance) << std::endl;
+  }
+}
+
+void SQLiteSink::commit() {
+  try {
+    if (batch)
+      batch->commit();
+  } catch (std::exception& ex) {
+    std::cerr << "ERROR in DB logging (commit) " << ex.what() << std::endl;
+  }
+  batch.reset();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "data_sink.hpp"
+#include "SQLiteCpp/SQLiteCpp.h"
+#include <memory>
+
+// Simulation data on a SQLite database (rescue and ambulance_event tables),
+// rows are inserted with statements prepared once and committed in a single
+// transaction per batch.
+class SQLiteSink : public DataSink {
+public:
+  struct Options {
+    bool wal = false, synchronous = true;
+  };
+  SQLiteSink(const std::string& db_filename, const Options& options, const SimulationContext& context, bool compact);
+  void write(const DataRecord& r) override;
+  void commit() override;
+protected:
+  void create_tables();
+  void create_compact_tables();
+  void write_code(Entity entity, std::int32_t code, const std::string& id) override;
+  void bind_time(SQLite::Statement& query, int column, Time t);
+  void bind_entity(SQLite::Statement& query, int column, Entity entity, std::int32_t index);
+  std::unique_ptr<SQLite::Database> db;
+  std::unique_ptr<SQLite::Statement> insert_rescue, insert_ambulance_event, insert_ambulance_state;
+  std::unique_ptr<SQLite::Statement> insert_code[HOSPITAL + 1];
+  std::unique_ptr<SQLite::Transaction> batch;
+};
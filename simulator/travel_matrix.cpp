@@ -0,0 +1,373 @@
+#include "travel_matrix.hpp"
+#include "data.hpp"
+#include "helpers.hpp"
+#include "instance.hpp"
+#include "haversine_routing.hpp"
+#include <cmath>
+#include <chrono>
+#include <map>
+#include <fstream>
+#include <cstring>
+
+// length of one degree of latitude (in km) on the sphere used by Routing::haversine
+const double KM_PER_DEGREE = 2.0 * M_PI * 6371.0 / 360.0;
+
+// places that the matrix cannot tell apart are estimated as by the haversine backend with its default speed model
+static const HaversineRouting::SpeedModel ESTIMATE_MODEL;
+
+static const char MATRIX_MAGIC[8] = { 'E', 'M', 'S', 'T', 'M', 'A', 'T', 'X' };
+
+static inline std::size_t aligned(std::size_t size)
+{
+  return (size + 7) & ~std::size_t(7);
+}
+
+std::int64_t TravelMatrix::cell_of(const Coordinate& c) const
+{
+  std::int64_t i = std::int64_t(std::floor(c.lat.__value / lat_step)), j = std::int64_t(std::floor(c.lon.__value / lon_step));
+  return (i << 32) ^ (j & 0xffffffff);
+}
+
+std::int64_t TravelMatrix::point_key(const Coordinate& c) const
+{
+  std::int64_t i = std::lround(c.lat.__value / RoutingCache::DEFAULT_RESOLUTION), j = std::lround(c.lon.__value / RoutingCache::DEFAULT_RESOLUTION);
+  return (i << 32) ^ (j & 0xffffffff);
+}
+
+void TravelMatrix::add_point(const Coordinate& c, Kind k)
+{
+  if (k == POINT)
+  {
+    if (point_index.count(point_key(c)))
+      return;
+    point_index[point_key(c)] = points.size();
+  }
+  else
+    cell_index[cell_of(c)] = points.size();
+  grid.insert(points.size(), c);
+  points.push_back(c);
+  kinds.push_back(k);
+}
+
+bool TravelMatrix::build(Routing& routing, const Instance& instance)
+{
+  auto start = std::chrono::steady_clock::now();
+  clear();
+  // the longitude step is scaled at the average latitude so that cells are roughly square
+  double ref_lat = 0.0;
+  for (const auto& e : instance.emergencies)
+    ref_lat += e.place.lat.__value;
+  if (!instance.emergencies.empty())
+    ref_lat /= instance.emergencies.size();
+  lat_step = cell_size / KM_PER_DEGREE;
+  lon_step = lat_step / std::cos(ref_lat * M_PI / 180.0);
+
+  for (const auto& a : instance.ambulances)
+    add_point(a.base, POINT);
+  for (const auto& h : instance.hospitals)
+    add_point(h->place, POINT);
+  // each cell is represented by the emergency place closest to the centroid of its emergencies
+  std::map<std::int64_t, std::vector<Coordinate>> cells;
+  for (const auto& e : instance.emergencies)
+    cells[cell_of(e.place)].push_back(e.place);
+  for (const auto& [cell, places] : cells)
+  {
+    double lat = 0.0, lon = 0.0;
+    for (const auto& p : places)
+    {
+      lat += p.lat.__value;
+      lon += p.lon.__value;
+    }
+    Coordinate centroid{osrm::util::FloatLongitude{lon / places.size()}, osrm::util::FloatLatitude{lat / places.size()}};
+    Coordinate representative = places.front();
+    for (const auto& p : places)
+      if (Routing::haversine(p, centroid) < Routing::haversine(representative, centroid))
+        representative = p;
+    add_point(representative, CELL);
+  }
+
+  if (!routing.compute_table(points, points, durations, distances))
+  {
+    spdlog::error("Could not compute the travel matrix");
+    clear();
+    return false;
+  }
+  durations_ = durations.data();
+  distances_ = distances.data();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  spdlog::info("Travel matrix computed for {} points ({} cells of {} km) in {} ms", points.size(), cells.size(), cell_size, elapsed.count());
+  return true;
+}
+
+std::optional<std::size_t> TravelMatrix::locate(const Coordinate& c) const
+{
+  if (points.empty())
+    return {};
+  auto it = point_index.find(point_key(c));
+  if (it != point_index.end())
+    return it->second;
+  it = cell_index.find(cell_of(c));
+  if (it != cell_index.end())
+    return it->second;
+  return {};
+}
+
+std::optional<RoutingCache::Entry> TravelMatrix::lookup(const Coordinate& start_point, const Coordinate& end_point) const
+{
+  auto s = locate(start_point);
+  if (!s)
+    return {};
+  auto d = locate(end_point);
+  if (!d)
+    return {};
+  // two different places in the same cell cannot be told apart by the matrix
+  if (*s == *d && point_key(start_point) != point_key(end_point))
+    return {};
+  std::size_t i = *s * points.size() + *d;
+  return RoutingCache::Entry{ durations_[i], distances_[i] };
+}
+
+std::optional<std::size_t> TravelMatrix::nearest(const Coordinate& c) const
+{
+  auto l = locate(c);
+  if (l)
+    return *l;
+  if (points.empty())
+    return {};
+  // the radius is doubled until the closest point found is within it (then no other point can be closer),
+  // as long as the cells visited are fewer than the points, otherwise all the points are scanned
+  std::optional<std::size_t> best;
+  units::length::kilometer_t best_distance;
+  for (double radius = cell_size; std::pow(2.0 * radius / cell_size + 1.0, 2) <= double(points.size()); radius *= 2.0)
+  {
+    grid.query(c, units::length::kilometer_t(radius), [this, &c, &best, &best_distance](std::size_t i) {
+      auto d = Routing::haversine(c, points[i]);
+      // the cells are visited in no particular order, ties go to the first point
+      if (!best || d < best_distance || (d == best_distance && i < *best))
+      {
+        best = i;
+        best_distance = d;
+      }
+    });
+    if (best && best_distance <= units::length::kilometer_t(radius))
+      return best;
+  }
+  best = 0;
+  best_distance = Routing::haversine(c, points[0]);
+  for (std::size_t i = 1; i < points.size(); i++)
+  {
+    auto d = Routing::haversine(c, points[i]);
+    if (d < best_distance)
+    {
+      best = i;
+      best_distance = d;
+    }
+  }
+  return best;
+}
+
+RoutingCache::Entry TravelMatrix::lookup_nearest(const Coordinate& start_point, const Coordinate& end_point) const
+{
+  auto entry = lookup(start_point, end_point);
+  if (entry)
+    return *entry;
+  auto s = nearest(start_point), d = nearest(end_point);
+  if (!s || !d || (*s == *d && point_key(start_point) != point_key(end_point)))
+  {
+    // the diagonal entry (no travel at all) would be returned for two different places
+    double distance = ESTIMATE_MODEL.road_distance(start_point, end_point);
+    return RoutingCache::Entry{ float(ESTIMATE_MODEL.travel_time(distance)), float(1000.0 * distance) };
+  }
+  std::size_t i = *s * points.size() + *d;
+  return RoutingCache::Entry{ durations_[i], distances_[i] };
+}
+
+void TravelMatrix::clear()
+{
+  points.clear(); kinds.clear(); point_index.clear(); cell_index.clear();
+  grid = SpatialGrid<std::size_t>(cell_size);
+  durations.clear(); distances.clear();
+  durations_ = distances_ = nullptr;
+  file.close();
+}
+
+bool TravelMatrix::save(const std::string& filename) const
+{
+  std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+  if (!os)
+  {
+    spdlog::error("Could not write travel matrix file {}", filename);
+    return false;
+  }
+  FileHeader header{};
+  std::memcpy(header.magic, MATRIX_MAGIC, sizeof(MATRIX_MAGIC));
+  header.version = FILE_VERSION;
+  header.points = points.size();
+  header.cell_size = cell_size;
+  header.lat_step = lat_step;
+  header.lon_step = lon_step;
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  std::vector<double> values(points.size());
+  for (std::size_t i = 0; i < points.size(); i++)
+    values[i] = points[i].lon.__value;
+  os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+  for (std::size_t i = 0; i < points.size(); i++)
+    values[i] = points[i].lat.__value;
+  os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+  std::vector<char> padded_kinds(aligned(kinds.size()), 0);
+  std::copy(kinds.begin(), kinds.end(), padded_kinds.begin());
+  os.write(padded_kinds.data(), padded_kinds.size());
+  os.write(reinterpret_cast<const char*>(durations_), points.size() * points.size() * sizeof(float));
+  os.write(reinterpret_cast<const char*>(distances_), points.size() * points.size() * sizeof(float));
+  return bool(os);
+}
+
+bool TravelMatrix::open(const std::string& filename)
+{
+  auto start = std::chrono::steady_clock::now();
+  clear();
+  if (!file.open(filename))
+  {
+    spdlog::error("Could not open travel matrix file {}", filename);
+    return false;
+  }
+  FileHeader header;
+  if (file.size() < sizeof(header))
+  {
+    spdlog::error("Travel matrix file {} is not valid", filename);
+    file.close();
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (!std::equal(header.magic, header.magic + sizeof(header.magic), MATRIX_MAGIC) || header.version != FILE_VERSION)
+  {
+    spdlog::error("Travel matrix file {} is not valid (or has an unsupported version)", filename);
+    file.close();
+    return false;
+  }
+  // a count larger than the file (or whose matrices would not fit in it) would overflow the expected size
+  std::size_t n = header.points;
+  if (n > file.size() || (n > 0 && n > file.size() / (2 * sizeof(float)) / n))
+  {
+    spdlog::error("Travel matrix file {} is not valid", filename);
+    file.close();
+    return false;
+  }
+  std::size_t coordinates_offset = sizeof(header), kinds_offset = coordinates_offset + 2 * n * sizeof(double), matrix_offset = kinds_offset + aligned(n);
+  if (file.size() != matrix_offset + 2 * n * n * sizeof(float))
+  {
+    spdlog::error("Travel matrix file {} is truncated", filename);
+    file.close();
+    return false;
+  }
+  const double* longitudes = reinterpret_cast<const double*>(file.data() + coordinates_offset);
+  const double* latitudes = longitudes + n;
+  const std::uint8_t* file_kinds = reinterpret_cast<const std::uint8_t*>(file.data() + kinds_offset);
+  // the grid steps and the kinds are checked before anything is built
+  bool valid = std::isfinite(header.cell_size) && header.cell_size > 0.0 && std::isfinite(header.lat_step) && header.lat_step > 0.0 && std::isfinite(header.lon_step) && header.lon_step > 0.0;
+  for (std::size_t i = 0; valid && i < n; i++)
+    valid = file_kinds[i] <= CELL;
+  if (!valid)
+  {
+    spdlog::error("Travel matrix file {} is not valid", filename);
+    file.close();
+    return false;
+  }
+  cell_size = header.cell_size;
+  lat_step = header.lat_step;
+  lon_step = header.lon_step;
+  grid = SpatialGrid<std::size_t>(cell_size);
+  for (std::size_t i = 0; i < n; i++)
+    add_point(Coordinate{osrm::util::FloatLongitude{longitudes[i]}, osrm::util::FloatLatitude{latitudes[i]}}, Kind(file_kinds[i]));
+  durations_ = reinterpret_cast<const float*>(file.data() + matrix_offset);
+  distances_ = durations_ + n * n;
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  spdlog::info("Travel matrix loaded from {} for {} points in {} ms", filename, n, elapsed.count());
+  return true;
+}
+
+bool MatrixRouting::compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances)
+{
+  durations.resize(sources.size() * destinations.size());
+  distances.resize(sources.size() * destinations.size());
+  std::vector<bool> missing_source(sources.size(), false), missing_destination(destinations.size(), false);
+  bool missing = false;
+  for (size_t s = 0; s < sources.size(); s++)
+  {
+    for (size_t d = 0; d < destinations.size(); d++)
+    {
+      std::optional<RoutingCache::Entry> entry;
+      if (matrix)
+      {
+        entry = matrix->lookup(sources[s], destinations[d]);
+        if (!entry && !fallback)
+          entry = matrix->lookup_nearest(sources[s], destinations[d]);
+      }
+      if (entry)
+      {
+        durations[s * destinations.size() + d] = entry->duration;
+        distances[s * destinations.size() + d] = entry->distance;
+        hits++;
+      }
+      else
+      {
+        missing_source[s] = missing_destination[d] = true;
+        missing = true;
+      }
+    }
+  }
+  if (!missing)
+    return true;
+  if (!fallback)
+  {
+    spdlog::error("No routing data available");
+    return false;
+  }
+  
+  // the sub-table of the uncovered pairs is forwarded to the fallback backend
+  std::list<Coordinate> table_sources, table_destinations;
+  std::vector<size_t> source_index, destination_index;
+  for (size_t s = 0; s < sources.size(); s++)
+    if (missing_source[s])
+    {
+      table_sources.push_back(sources[s]);
+      source_index.push_back(s);
+    }
+  for (size_t d = 0; d < destinations.size(); d++)
+    if (missing_destination[d])
+    {
+      table_destinations.push_back(destinations[d]);
+      destination_index.push_back(d);
+    }
+  auto computed = fallback->compute_distances(table_sources, table_destinations);
+  if (computed.empty())
+    return false;
+  for (size_t s = 0; s < source_index.size(); s++)
+  {
+    for (size_t d = 0; d < destination_index.size(); d++)
+    {
+      const auto& segment = computed[s * destination_index.size() + d];
+      size_t r = source_index[s] * destinations.size() + destination_index[d];
+      durations[r] = units::time::second_t(segment.duration).value();
+      distances[r] = units::length::meter_t(segment.distance).value();
+    }
+  }
+  return true;
+}
+
+std::list<Routing::Segment> MatrixRouting::compute_route(const Coordinate& start_point, const Coordinate& end_point)
+{
+  if (fallback)
+    return fallback->compute_route(start_point, end_point);
+  // without the road network the route is a single straight segment
+  return { compute_distances(start_point, end_point) };
+}
+
+void MatrixRouting::log_statistics() const
+{
+  spdlog::info("Travel matrix: {} hits", hits.load());
+  const auto& route_stats = route_cache_.statistics();
+  spdlog::info("Route cache: {} hits, {} misses, {} evictions, {} entries", route_stats.hits, route_stats.misses, route_stats.evictions, route_cache_.size());
+  if (fallback)
+    fallback->log_statistics();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "routing.hpp"
+#include "mapped_file.hpp"
+#include "spatial_index.hpp"
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <cstdint>
+#include <atomic>
+
+class Instance;
+
+// Dense matrix of travel durations and distances among the fixed points of a
+// scenario (ambulance bases and hospitals) and the cells of a uniform lat/lon
+// grid covering the emergency places. It is computed once at startup with a
+// single many-to-many table request. A coordinate that is not exactly a base or
+// a hospital is mapped to the grid cell it falls into (if the cell is covered).
+class TravelMatrix {
+public:
+  enum Kind : std::uint8_t {
+    POINT,
+    CELL
+  };
+  // cell size is expressed in km
+  static constexpr double DEFAULT_CELL_SIZE = 1.0;
+
+  TravelMatrix(double cell_size = DEFAULT_CELL_SIZE) : cell_size(cell_size), lat_step(0.0), lon_step(0.0), durations_(nullptr), distances_(nullptr), grid(cell_size) {}
+
+  // collects bases, hospitals and emergency cells from the instance and fills the matrix
+  bool build(Routing& routing, const Instance& instance);
+  
+  // Binary file format (native endianness, all sections 8-byte aligned):
+  //   FileHeader
+  //   double longitudes[points], double latitudes[points]
+  //   uint8_t kinds[points] (padded)
+  //   float durations[points * points], float distances[points * points]
+  // The matrices are not copied when opening the file, they are read from the mapping.
+  bool save(const std::string& filename) const;
+  bool open(const std::string& filename);
+
+  std::optional<std::size_t> locate(const Coordinate& c) const;
+  std::optional<RoutingCache::Entry> lookup(const Coordinate& start_point, const Coordinate& end_point) const;
+  // as lookup, but uncovered places are approximated by the closest point of the matrix
+  // (different places mapped to the same point are estimated from their haversine distance)
+  RoutingCache::Entry lookup_nearest(const Coordinate& start_point, const Coordinate& end_point) const;
+  inline std::size_t size() const { return points.size(); }
+protected:
+  struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t points;
+    double cell_size, lat_step, lon_step;
+  };
+  static constexpr std::uint32_t FILE_VERSION = 1;
+  void add_point(const Coordinate& c, Kind k);
+  void clear();
+  // closest point of the matrix (searched in the grid cells around the place), none if the matrix is empty
+  std::optional<std::size_t> nearest(const Coordinate& c) const;
+  std::int64_t cell_of(const Coordinate& c) const;
+  std::int64_t point_key(const Coordinate& c) const;
+
+  double cell_size;
+  // grid steps, in degrees
+  double lat_step, lon_step;
+  // representative coordinate of each row/column and its kind
+  std::vector<Coordinate> points;
+  std::vector<Kind> kinds;
+  // durations (in seconds) and distances (in meters) in row-major order, they
+  // point either to the computed vectors or to the mapped file
+  std::vector<float> durations, distances;
+  const float* durations_;
+  const float* distances_;
+  MappedFile file;
+  std::unordered_map<std::int64_t, std::size_t> point_index, cell_index;
+  // all the points indexed by position, for the closest point of an uncovered place
+  SpatialGrid<std::size_t> grid;
+};
+
+// Routing backend answering from a precomputed travel matrix. The pairs that are
+// not covered by the matrix are delegated to the fallback backend, if any,
+// otherwise they are approximated by the closest points of the matrix.
+class MatrixRouting : public Routing {
+public:
+  MatrixRouting(std::shared_ptr<const TravelMatrix> matrix, std::unique_ptr<Routing> fallback = nullptr) : Routing(0), matrix(matrix), fallback(std::move(fallback)), hits(0) {}
+  
+  // the matrix can be set once the entities are loaded (until then everything is forwarded to the fallback)
+  inline void set_matrix(std::shared_ptr<const TravelMatrix> matrix) { this->matrix = matrix; }
+  
+  using Routing::compute_distances;
+  std::list<Segment> compute_route(const Coordinate& start_point, const Coordinate& end_point) override;
+  // the cache is only used for the requests forwarded to the fallback backend
+  RoutingCache& cache() override { return fallback ? fallback->cache() : cache_; }
+  void log_statistics() const override;
+  
+protected:
+  bool compute_table(const std::vector<Coordinate>& sources, const std::vector<Coordinate>& destinations, std::vector<float>& durations, std::vector<float>& distances) override;
+  std::shared_ptr<const TravelMatrix> matrix;
+  std::unique_ptr<Routing> fallback;
+  std::atomic<std::size_t> hits;
+};